@@ -110,6 +110,8 @@ namespace Ogre
 			#else
 			TexturePtr        texture;
 			#endif
+			//! serial of the frame shown in the texture, see TheoraVideoFrame::getDirtyReference()
+			unsigned long     serial;
 		};
 		std::map<String,ClipTexture> mClipsTextures;
 		bool mbInit;
@@ -31,6 +31,7 @@ the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
 #include "TheoraVideoFrame.h"
 #include "TheoraTimer.h"
 #include <vector>
+#include <algorithm>
 
 #if AV_OGRE_NEXT_VERSION >= 0x20100
 #include <OgreHlmsManager.h>
@@ -85,21 +86,64 @@ namespace Ogre
 		createVideoTexture(mInputFileName, material_name, group_name, group_name);
 	}
 	
+	// runs of rows [first,second) of a frame that are uploaded to the texture
+	typedef std::vector<std::pair<int, int> > RowRuns;
+
 #if AV_OGRE_NEXT_VERSION >= 0x20100
-	static void fillTexture(TextureGpu* texture, const uint8* data, int xSize, int ySize) {
+	// uploads the runs of rows of an image xSize pixels wide through a single staging texture,
+	// each run is mapped as a region of its own
+	static void fillTexture(TextureGpu* texture, const uint8* data, int xSize, const RowRuns& runs) {
 		TextureGpuManager *textureMgr = Root::getSingletonPtr()->getRenderSystem()->getTextureGpuManager();
-		StagingTexture *stagingTexture = textureMgr->getStagingTexture( xSize, ySize, 1, 1, PFG_RGBA8_UNORM );
+		uint32 rows = 0;
+		for (size_t i = 0; i < runs.size(); i++)
+			rows += runs[i].second - runs[i].first;
+		StagingTexture *stagingTexture = textureMgr->getStagingTexture( xSize, rows, 1, 1, PFG_RGBA8_UNORM );
 		
+		std::vector<TextureBox> boxes;
 		stagingTexture->startMapRegion();
-		TextureBox texBox = stagingTexture->mapRegion( xSize, ySize, 1, 1, PFG_RGBA8_UNORM );
-		texBox.copyFrom( data, xSize, ySize, 4 * xSize );
+		for (size_t i = 0; i < runs.size(); i++) {
+			int ySize = runs[i].second - runs[i].first;
+			TextureBox texBox = stagingTexture->mapRegion( xSize, ySize, 1, 1, PFG_RGBA8_UNORM );
+			texBox.copyFrom( data + 4 * xSize * runs[i].first, xSize, ySize, 4 * xSize );
+			boxes.push_back(texBox);
+		}
 		stagingTexture->stopMapRegion();
 		
-		stagingTexture->upload( texBox, texture, 0, 0, 0, true );
+		for (size_t i = 0; i < runs.size(); i++) {
+			int ySize = runs[i].second - runs[i].first;
+			TextureBox dstBox( xSize, ySize, 1, 1, 4, 4 * xSize, 4 * xSize * ySize );
+			dstBox.y = runs[i].first;
+			stagingTexture->upload( boxes[i], texture, 0, 0, &dstBox, true );
+		}
 		textureMgr->removeStagingTexture( stagingTexture );
 	}
+
+	// uploads rows [y0,y1) of an image xSize pixels wide
+	static void fillTexture(TextureGpu* texture, const uint8* data, int xSize, int y0, int y1) {
+		fillTexture(texture, data, xSize, RowRuns(1, std::make_pair(y0, y1)));
+	}
+#else
+	// uploads the runs of rows of an image xSize pixels wide, the rest of the texture is left as it is
+	static void fillTexture(TexturePtr texture, const unsigned char* data, int xSize, const RowRuns& runs) {
+		HardwarePixelBufferSharedPtr buffer = texture->getBuffer();
+		for (size_t i = 0; i < runs.size(); i++) {
+			// write only: the locked rows aren't read back, and unlike HBL_DISCARD the rest of
+			// the texture keeps its contents
+			const PixelBox& box = buffer->lock(Box(0, runs[i].first, xSize, runs[i].second), HardwareBuffer::HBL_WRITE_ONLY);
+			unsigned char* texData = (unsigned char*) box.data;
+			for (int y = runs[i].first; y < runs[i].second; y++, texData += 4 * box.rowPitch)
+				memcpy(texData, data + 4 * xSize * y, 4 * xSize);
+			buffer->unlock();
+		}
+	}
 #endif
 
+	static bool isTileRowDirty(TheoraVideoFrame* f, int y) {
+		for (int x = 0; x < f->getNumTilesX(); x++)
+			if (f->isTileDirty(x, y)) return true;
+		return false;
+	}
+
 	TheoraVideoClip* OgreVideoManager::createVideoTexture(
 		const String& video_file_name, const String& material_name,
 		const String& video_group_name, const String& group_name
@@ -137,7 +181,7 @@ namespace Ogre
 		t->_transitionTo( GpuResidency::Resident, reinterpret_cast<uint8*>(data) );
 		t->_setNextResidencyStatus( GpuResidency::Resident );
 		
-		fillTexture(t, data, w, h);
+		fillTexture(t, data, w, 0, h);
 		
 		OGRE_FREE_SIMD(data, MEMCATEGORY_RENDERSYS);
 		t->notifyDataIsReady();
@@ -153,7 +197,9 @@ namespace Ogre
 		t->getBuffer()->unlock();
 #endif
 
-		mClipsTextures[name]={clip,t};
+		mClipsTextures[name]={clip,t,0};
+		// only the parts of the texture that change from one frame to the next are uploaded
+		clip->setDirtyTileTracking(true);
 
 #if AV_OGRE_NEXT_VERSION >= 0x20100
 		// set it in a datablock
@@ -220,16 +266,34 @@ namespace Ogre
 			{
 				int w=f->getStride(),h=f->getHeight();
 				
+				if (f->getDirtyReference() != 0 && f->getDirtyReference() == it->second.serial)
+				{
+					// the texture holds the frame the dirty mask was computed against,
+					// upload each run of tile rows that have changed tiles
+					RowRuns runs;
+					for (int y0=0,y1;y0<f->getNumTilesY();y0=y1)
+					{
+						for (y1=y0;y1<f->getNumTilesY() && isTileRowDirty(f,y1);y1++);
+						if (y1 > y0)
+							runs.push_back(std::make_pair(y0*TH_DIRTY_TILE_SIZE,std::min(y1*TH_DIRTY_TILE_SIZE,h)));
+						else y1++;
+					}
+					if (!runs.empty()) fillTexture(it->second.texture, f->getBuffer(), w, runs);
+				}
+				else
+				{
 #if AV_OGRE_NEXT_VERSION >= 0x20100
-				fillTexture(it->second.texture, reinterpret_cast<const uint8*>(f->getBuffer()), w, h);
+					fillTexture(it->second.texture, reinterpret_cast<const uint8*>(f->getBuffer()), w, 0, h);
 #else
-				unsigned char *texData=(unsigned char*) it->second.texture->getBuffer()->lock(HardwareBuffer::HBL_DISCARD);
-				unsigned char *videoData=f->getBuffer();
-				
-				memcpy(texData,videoData,w*h*4);
-				
-				it->second.texture->getBuffer()->unlock();
+					unsigned char *texData=(unsigned char*) it->second.texture->getBuffer()->lock(HardwareBuffer::HBL_DISCARD);
+					unsigned char *videoData=f->getBuffer();
+					
+					memcpy(texData,videoData,w*h*4);
+					
+					it->second.texture->getBuffer()->unlock();
 #endif
+				}
+				it->second.serial=f->getSerial();
 				it->second.clip->popFrame();
 			}
 		}
@@ -0,0 +1,103 @@
+/************************************************************************************
+This source file is part of the Theora Video Playback Library
+For latest info, see http://libtheoraplayer.sourceforge.net/
+*************************************************************************************
+Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
+This program is free software; you can redistribute it and/or modify it under
+the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
+*************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "TheoraConversion.h"
+
+/**
+	Runs every SIMD converter the CPU supports against the reference (C) converter on
+	random planes. RGB modes may differ by 1 because the kernels don't use the rounded
+	tables, all other modes have to be bit exact. Odd sizes exercise the tail handling
+*/
+
+void createYUVtoRGBtables();
+
+static const int sizes[][2]={{2,2},{3,3},{17,9},{31,17},{33,15},{63,33},{65,31},{127,63},{641,361},{721,405}};
+static const char* mode_names[TH_NUM_OUTPUT_MODES]={"","RGB","RGBA","ARGB","BGR","BGRA","ABGR","GREY","GREY3",
+                                                     "GREY3A","AGREY3","YUV","YUVA","AYUV","YUV420P","NV12"};
+
+static void fillPlane(th_img_plane* plane,std::vector<unsigned char>& data,int width,int height)
+{
+	// libtheora's planes are usually bottom up, so use a negative stride like it does.
+	// converters work on pairs of rows, an odd height reads one row past the plane
+	int stride=width+16;
+	data.resize(stride*(height+1));
+	for (size_t i=0;i<data.size();i++) data[i]=(unsigned char) rand();
+	plane->width=width;
+	plane->height=height;
+	plane->stride=-stride;
+	plane->data=&data[0]+height*stride;
+}
+
+static int compare(const char* set,TheoraOutputMode mode,TheoraConversionFunction fn)
+{
+	std::vector<unsigned char> y,u,v,expected,result;
+	th_img_plane planes[3];
+	int failures=0,tolerance=(mode <= TH_ABGR) ? 1 : 0;
+	for (unsigned int i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++)
+	{
+		// chroma planes are half the luma size. with an odd width the last luma pixel shares
+		// the chroma sample after the plane's width, like the pixel pairs before it
+		int w=sizes[i][0],h=sizes[i][1],cw=w/2,ch=(h+1)/2;
+		fillPlane(&planes[0],y,w,h);
+		fillPlane(&planes[1],u,cw,ch);
+		fillPlane(&planes[2],v,cw,ch);
+		// even stride in pixels with padding, planar modes need room for the chroma planes
+		int stride=((w+1) & ~1)+8,size=stride*4*(h+1)*2;
+		expected.assign(size,0xAB);
+		result.assign(size,0xAB);
+		reference_conversion_functions[mode](planes,&expected[0],stride);
+		fn(planes,&result[0],stride);
+		for (int j=0;j<size;j++)
+		{
+			if (abs(expected[j]-result[j]) <= tolerance) continue;
+			printf("%s %s %dx%d: byte %d is %d, expected %d\n",set,mode_names[mode],w,h,j,result[j],expected[j]);
+			failures++;
+			break;
+		}
+	}
+	return failures;
+}
+
+int main()
+{
+	struct InstructionSet
+	{
+		const char* name;
+		int feature;
+		bool (*get)(TheoraConversionFunction*);
+	} sets[]={{"SSE2",TH_CPU_SSE2,_getSSE2ConversionFunctions},
+	          {"AVX2",TH_CPU_AVX2,_getAVX2ConversionFunctions},
+	          {"NEON",TH_CPU_NEON,_getNEONConversionFunctions}};
+
+	createYUVtoRGBtables();
+	srand(1);
+	int features=_getCPUFeatures(),failures=0,tested=0;
+	TheoraConversionFunction table[TH_NUM_OUTPUT_MODES];
+	for (unsigned int i=0;i<sizeof(sets)/sizeof(sets[0]);i++)
+	{
+		memcpy(table,reference_conversion_functions,sizeof(table));
+		if (!(features & sets[i].feature) || !sets[i].get(table))
+		{
+			printf("%s: not available, skipped\n",sets[i].name);
+			continue;
+		}
+		for (int mode=1;mode<TH_NUM_OUTPUT_MODES;mode++)
+		{
+			if (table[mode] == reference_conversion_functions[mode]) continue;
+			failures+=compare(sets[i].name,(TheoraOutputMode) mode,table[mode]);
+			tested++;
+		}
+		printf("%s: tested\n",sets[i].name);
+	}
+	printf("%d converters tested, %d failures\n",tested,failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,99 @@
+/************************************************************************************
+This source file is part of the Theora Video Playback Library
+For latest info, see http://libtheoraplayer.sourceforge.net/
+*************************************************************************************
+Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
+This program is free software; you can redistribute it and/or modify it under
+the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
+*************************************************************************************/
+#include <stdio.h>
+#include <string>
+#include <atomic>
+#include "TheoraVideoManager.h"
+#include "TheoraVideoClip.h"
+#include "TheoraDataSource.h"
+#include "TheoraUtil.h"
+
+/**
+	Measures how fast each clip given on the command line is decoded when frames are
+	popped as soon as they're ready, eg.
+	TheoraDecodeBenchmark demos/media/oggs/konqi.ogg
+
+	Every clip is decoded with the demuxer reading 4096 bytes at a time, the size that
+	used to be fixed, and with the read size chosen from the clip's data rate.
+*/
+
+static const int num_passes=3;
+
+//! counts the reads the demuxer makes
+class CountingDataSource : public TheoraFileDataSource
+{
+public:
+	std::atomic<int> mNumReads;
+
+	CountingDataSource(std::string filename) : TheoraFileDataSource(filename,1) { mNumReads=0; }
+	int read(void* output,int nBytes)
+	{
+		mNumReads++;
+		return TheoraFileDataSource::read(output,nBytes);
+	}
+};
+
+static void silentLog(std::string)
+{
+	// the benchmark prints its own results
+}
+
+//! returns false if the clip can't be loaded
+static bool benchmarkDecoding(TheoraVideoManager* manager,const char* filename,int readChunkSize)
+{
+	CountingDataSource* source=new CountingDataSource(filename);
+	TheoraVideoClip* clip=manager->createVideoClipAsync(source,TH_RGBA);
+	// applied once the clip is loaded, before any frame is demuxed
+	clip->setReadChunkSize(readChunkSize);
+	while (!clip->isLoaded() && !clip->hasLoadFailed()) _psleep(1);
+	if (clip->hasLoadFailed())
+	{
+		printf("%s: unable to load\n",filename);
+		manager->destroyVideoClip(clip);
+		return 0;
+	}
+	// the timer stays at 0 because update() is never called, so no frame is dropped as
+	// late. looping keeps the worker busy for several passes
+	clip->setAutoRestart(true);
+
+	int frames=0,target=num_passes*clip->getNumFrames(),reads=source->mNumReads;
+	double start=_getTime();
+	while (frames < target)
+	{
+		if (clip->getNumReadyFrames() == 0) { _psleep(0); continue; }
+		clip->popFrame();
+		frames++;
+	}
+	double time=_getTime()-start;
+	reads=source->mNumReads-reads;
+
+	printf("  %6d byte reads: %8.1f frames/s, %6d reads, %6.1f reads/frame, %d decoder stalls\n",
+	       clip->getReadChunkSize(),frames/time,reads,(float) reads/frames,clip->getNumDecoderStalls());
+	manager->destroyVideoClip(clip);
+	return 1;
+}
+
+int main(int argc,char** argv)
+{
+	if (argc < 2)
+	{
+		printf("usage: %s clip.ogg [clip.ogg ...]\n",argv[0]);
+		return 1;
+	}
+	TheoraVideoManager::setLogFunction(silentLog);
+	TheoraVideoManager* manager=new TheoraVideoManager(1);
+	for (int i=1;i<argc;i++)
+	{
+		printf("%s:\n",argv[i]);
+		if (benchmarkDecoding(manager,argv[i],4096))
+			benchmarkDecoding(manager,argv[i],0);
+	}
+	delete manager;
+	return 0;
+}
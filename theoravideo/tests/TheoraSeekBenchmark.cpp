@@ -0,0 +1,128 @@
+/************************************************************************************
+This source file is part of the Theora Video Playback Library
+For latest info, see http://libtheoraplayer.sourceforge.net/
+*************************************************************************************
+Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
+This program is free software; you can redistribute it and/or modify it under
+the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
+*************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <atomic>
+#include "TheoraVideoManager.h"
+#include "TheoraVideoClip.h"
+#include "TheoraTimer.h"
+#include "TheoraException.h"
+#include "TheoraUtil.h"
+
+/**
+	Measures the time from TheoraVideoClip::seek() until the first frame at the seek
+	position is decoded, for every clip given on the command line, eg.
+	TheoraSeekBenchmark demos/media/oggs/konqi.ogg
+
+	Each clip is seeked to a number of positions spread over the file, first while the
+	seek index only covers what was played, then again once it covers the whole file.
+*/
+
+static const int num_seeks=20;
+
+/**
+	Time doesn't advance because the benchmark never calls TheoraVideoManager::update().
+	The worker thread seeks the timer once it has moved the clip to the new position
+	and cleared the frame queue, any frame decoded after that is at the seek position
+*/
+class SeekTimer : public TheoraTimer
+{
+public:
+	std::atomic<bool> mSeeked;
+
+	SeekTimer() { mSeeked=false; }
+	void seek(float time)
+	{
+		TheoraTimer::seek(time);
+		mSeeked.store(true);
+	}
+};
+
+static void silentLog(std::string)
+{
+	// the benchmark prints its own results
+}
+
+//! stores the latency of each seek in seconds
+static void benchmarkSeeks(TheoraVideoClip* clip,SeekTimer* timer,double* latencies)
+{
+	for (int i=0;i<num_seeks;i++)
+	{
+		// alternate between the two halves of the file, so seeks go backwards as well
+		float time=clip->getDuration()*((i % 2) ? 0.5f-0.45f*i/num_seeks : 0.5f+0.45f*i/num_seeks);
+		// nothing is being decoded once the queue is full
+		while (clip->getNumReadyFrames() < clip->getNumPrecachedFrames()) _psleep(1);
+		timer->mSeeked=false;
+
+		double start=_getTime();
+		clip->seek(time);
+		while (!timer->mSeeked || clip->getNumReadyFrames() == 0) _psleep(0);
+		latencies[i]=_getTime()-start;
+	}
+}
+
+static void printLatencies(const char* name,double* latencies)
+{
+	double sum=0,max=0;
+	for (int i=0;i<num_seeks;i++)
+	{
+		sum+=latencies[i];
+		if (latencies[i] > max) max=latencies[i];
+	}
+	printf("  %-22s average %7.2f ms, max %7.2f ms\n",name,sum*1000/num_seeks,max*1000);
+}
+
+int main(int argc,char** argv)
+{
+	if (argc < 2)
+	{
+		printf("usage: %s clip.ogg [clip.ogg ...]\n",argv[0]);
+		return 1;
+	}
+	TheoraVideoManager::setLogFunction(silentLog);
+	TheoraVideoManager* manager=new TheoraVideoManager(2);
+	double latencies[num_seeks];
+	for (int i=1;i<argc;i++)
+	{
+		TheoraVideoClip* clip;
+		SeekTimer timer;
+		try
+		{
+			clip=manager->createVideoClip(argv[i],TH_RGBA);
+		}
+		catch (_TheoraGenericException& e)
+		{
+			printf("%s: %s\n",argv[i],e.getErrorText().c_str());
+			continue;
+		}
+		if (clip->getDuration() <= 0)
+		{
+			printf("%s: unknown duration, skipped\n",argv[i]);
+			manager->destroyVideoClip(clip);
+			continue;
+		}
+		clip->setTimer(&timer);
+		// the queue can always be filled, even right before the end of the file
+		clip->setAutoRestart(true);
+		printf("%s (%dx%d, %d frames):\n",argv[i],clip->getWidth(),clip->getHeight(),clip->getNumFrames());
+
+		benchmarkSeeks(clip,&timer,latencies);
+		printLatencies("partial seek index:",latencies);
+
+		clip->scanSeekIndex();
+		while (!clip->isSeekIndexComplete()) _psleep(1);
+		benchmarkSeeks(clip,&timer,latencies);
+		printLatencies("complete seek index:",latencies);
+
+		manager->destroyVideoClip(clip);
+	}
+	delete manager;
+	return 0;
+}
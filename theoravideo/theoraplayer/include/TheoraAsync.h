@@ -33,6 +33,40 @@ public:
 	void unlock();
 };
 
+/**
+    An event counter, used to put threads to sleep until there is something for them to do.
+
+	signal() increments the counter and wakes up all waiting threads. To avoid missing a
+	signal, read the counter with getCount() before checking for work and pass that
+	value to wait(), which returns immediately if the counter has changed in the meantime.
+ */
+class TheoraEvent
+{
+protected:
+#ifdef _WIN32
+	void* mMutex;
+	void* mCondition;
+#else
+    pthread_mutex_t mMutex;
+    pthread_cond_t mCondition;
+#endif
+	unsigned int mCount;
+public:
+	TheoraEvent();
+	~TheoraEvent();
+	//! returns the current value of the counter
+	unsigned int getCount();
+	//! increments the counter and wakes up all threads waiting on this event
+	void signal();
+	/**
+	    \brief blocks the caller until the counter differs from 'count'
+
+		timeout is in milliseconds, negative values wait indefinitely.
+		returns false if the wait timed out
+	 */
+	bool wait(unsigned int count,int timeout=-1);
+};
+
 /**
     This is a Mutex object, used in thread syncronization.
  */
@@ -54,6 +88,8 @@ public:
 	void startThread();
 	//! The main thread loop function
 	virtual void executeThread()=0;
+	//! sets mThreadRunning to false without waiting for the thread, see waitforThread()
+	void stopThread();
 	//! sets mThreadRunning to false and waits for the thread to complete the last cycle
 	void waitforThread();
 
@@ -13,6 +13,10 @@ the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
 #include <string>
 #include "TheoraExport.h"
 
+class TheoraMutex;
+class TheoraEvent;
+class TheoraReadAheadThread;
+
 /**
 	This is a simple class that provides abstracted data feeding. You can use the
 	TheoraFileDataSource for regular file playback or you can implement your own
@@ -48,8 +52,14 @@ class TheoraPlayerExport TheoraFileDataSource : public TheoraDataSource
 	FILE* mFilePtr;
 	std::string mFilename;
 	unsigned long mSize;
+	//! opens the file, throws if it can't be opened
+	void open();
 public:
-	TheoraFileDataSource(std::string filename);
+	/**
+		opens the file right away unless deferOpen is set, then it's opened on first use.
+		TheoraVideoManager::createVideoClipAsync() uses that to open files on a worker thread
+	*/
+	TheoraFileDataSource(std::string filename,bool deferOpen=0);
 	~TheoraFileDataSource();
 
 	int read(void* output,int nBytes);
@@ -80,4 +90,86 @@ public:
 	unsigned long tell();
 };
 
+/**
+	Maps the file into memory and reads straight from the mapping.
+	Nearly as fast as TheoraMemoryFileDataSource once the file is in the OS page cache,
+	but the file isn't copied to the heap and clips playing the same file share its pages.
+*/
+class TheoraPlayerExport TheoraMmapDataSource : public TheoraDataSource
+{
+	std::string mFilename;
+	unsigned long mSize,mReadPointer;
+	unsigned char* mData;
+#ifdef _WIN32
+	void *mFile,*mMapping;
+#else
+	int mFile;
+#endif
+	//! asks the OS to start loading the pages at the read pointer, used after seeking
+	void prefetch();
+public:
+	TheoraMmapDataSource(std::string filename);
+	~TheoraMmapDataSource();
+
+	int read(void* output,int nBytes);
+	void seek(unsigned long byte_index);
+	std::string repr() { return "MMAP:"+mFilename; }
+	unsigned long size();
+	unsigned long tell();
+};
+
+/**
+	Wraps another data source and reads ahead of the decoder on a dedicated I/O thread,
+	so reads are served from memory and worker threads don't wait for the disk.
+
+	Reads outside the buffered window go straight to the wrapped source. If reading
+	continues sequentially from there (eg. after seeking), the window moves to the new
+	position. The wrapped source is deleted along with this object.
+*/
+class TheoraPlayerExport TheoraReadAheadDataSource : public TheoraDataSource
+{
+	friend class TheoraReadAheadThread;
+
+	TheoraDataSource* mSource;
+	TheoraReadAheadThread* mThread;
+	TheoraMutex* mMutex; //! guards the window and the read pointer
+	TheoraMutex* mSourceMutex; //! guards the wrapped data source
+	TheoraEvent* mDataEvent; //! signaled when the I/O thread buffered more data
+	TheoraEvent* mSpaceEvent; //! signaled when buffer space was freed or the window moved
+
+	//! circular buffer holding the window, mHead is the index of the window's first byte
+	unsigned char *mBuffer,*mChunk;
+	unsigned long mWindowSize,mChunkSize,mHead;
+	//! the window holds bytes [mWindowStart,mWindowStart+mFilled) of the wrapped source
+	unsigned long mWindowStart,mFilled;
+	unsigned long mReadPointer,mSize;
+	//! end of the last read that bypassed the window, a read starting there moves the window
+	unsigned long mMissEnd;
+	//! incremented when the window moves, so the I/O thread can discard a read for the old window
+	unsigned int mGeneration;
+	// benchmark vars, guarded by mMutex
+	unsigned long mNumHits,mNumMisses;
+	double mStallTime;
+
+	//! reads the next chunk of the wrapped source into the window, returns false if there's nothing to read
+	bool _fill();
+public:
+	//! window_size is the number of bytes that are read ahead of the read pointer
+	TheoraReadAheadDataSource(TheoraDataSource* source,unsigned long window_size=1048576);
+	~TheoraReadAheadDataSource();
+
+	int read(void* output,int nBytes);
+	void seek(unsigned long byte_index);
+	std::string repr() { return mSource->repr(); }
+	unsigned long size();
+	unsigned long tell();
+
+	//! benchmark function, number of reads served from the window without waiting
+	unsigned long getNumHits();
+	//! benchmark function, number of reads that had to wait for the I/O thread or bypass the window
+	unsigned long getNumMisses();
+	//! benchmark function, total time in seconds spent in reads that missed
+	float getStallTime();
+};
+
 #endif
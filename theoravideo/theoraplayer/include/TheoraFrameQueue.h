@@ -11,20 +11,64 @@ the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
 #define _TheoraFrameQueue_h
 
 #include "TheoraAsync.h"
-#include <list>
+#include <vector>
+#include <atomic>
+
+#define TH_CACHE_LINE_SIZE 64
 
 class TheoraVideoFrame;
 class TheoraVideoClip;
 
 /**
 	This class handles the frame queue. contains frames and handles their alloctation/deallocation
-	it is designed to be thread-safe
+
+	Frames are kept in a fixed size ring. The worker thread decoding the clip produces frames at
+	the tail and the thread displaying them consumes frames at the head. Both indices are atomic,
+	so fetching, counting and popping ready frames never takes a lock.
+	setSize() and reset() must not be called while a worker thread is decoding the clip
+	or while a frame is being popped.
+
+	Besides the clip, TheoraVideoClipViews can read the queue through their own read cursors.
+	Each frame counts the readers that haven't popped it yet and its slot is only reused
+	once that count drops to zero.
 */
 class TheoraFrameQueue
 {
-	std::list<TheoraVideoFrame*> mQueue;
+	std::vector<TheoraVideoFrame*> mFrames;
+	//! number of frames the queue fills, mFrames can hold more until surplus ready frames are popped
+	int mSize;
 	TheoraVideoClip* mParent;
 	TheoraMutex mMutex;
+
+	// the indices are free running counters (slot = index % size). The padding keeps the
+	// consumer and the producer index on separate cache lines so the render thread and
+	// the worker threads don't keep invalidating each other's cache line.
+	char mPad0[TH_CACHE_LINE_SIZE];
+	//! index of the first ready frame, advanced by pop() and clear()
+	std::atomic<unsigned int> mHead;
+	char mPad1[TH_CACHE_LINE_SIZE];
+	//! index of the first frame that isn't ready, advanced by push()
+	std::atomic<unsigned int> mTail;
+	char mPad2[TH_CACHE_LINE_SIZE];
+	//! read cursors of the clip's views, guarded by mMutex
+	std::vector<std::atomic<unsigned int>*> mViewHeads;
+	//! number of readers (the clip and its views) that haven't popped the frame in each slot
+	std::atomic<int>* mRefs;
+	//! max number of frames the queue fills at once, 0 means all of them. see setLimit()
+	std::atomic<int> mLimit;
+
+	//! drops a reader's reference to the frame at 'index' and frees the frame and its application buffer when it was the last one
+	void _release(unsigned int index);
+	//! moves a read cursor up to the tail, releasing the frames it skips
+	void _clearHead(std::atomic<unsigned int>* head);
+	//! returns how many frames can be queued at once, the size or the limit if it's lower
+	unsigned int _getCapacity();
+	/**
+		keeps at most as many frame buffers as the queue can fill: the frame in slot 'tail'
+		gets the buffer of a free frame and surplus buffers go back to the pool.
+		mMutex must be locked
+	*/
+	void _moveBuffers(unsigned int tail);
 public:
 	TheoraFrameQueue(int n,TheoraVideoClip* parent);
 	~TheoraFrameQueue();
@@ -36,12 +80,18 @@ public:
 		when you want to mark the frame as used by calling the pop() function.
 	*/
 	TheoraVideoFrame* getFirstAvailableFrame();
+	//! same as getFirstAvailableFrame(), for a view's read cursor
+	TheoraVideoFrame* getFirstAvailableFrame(std::atomic<unsigned int>* head);
 
-	//! return the number of used (not ready) frames
+	//! return the number of used frames (ready frames plus the one being decoded)
 	int getUsedCount();
 
 	//! return the number of ready frames
 	int getReadyCount();
+	//! return the number of ready frames a view hasn't read yet
+	int getReadyCount(std::atomic<unsigned int>* head);
+	//! returns true if requestEmptyFrame() would return a frame
+	bool hasEmptyFrame();
 
 	/**
 	    \brief remove the first available frame from the queue.
@@ -53,19 +103,50 @@ public:
 		specified amount in the TheoraVideoManager class and you won't be able to advance the video.
 	*/
 	void pop();
+	//! same as pop(), for a view's read cursor
+	void pop(std::atomic<unsigned int>* head);
+	/**
+	    \brief registers a view's read cursor
+
+		The view starts reading at the next frame that gets decoded.
+		A view that doesn't pop its frames holds up decoding of the clip.
+	*/
+	void addView(std::atomic<unsigned int>* head);
+	//! unregisters a view's read cursor and releases the frames it hasn't popped
+	void removeView(std::atomic<unsigned int>* head);
 	//! frees all decoded frames for reuse (does not destroy memory, just marks them as free)
 	void clear();
 	//! Called by WorkerThreads when they need to unload frame data, do not call directly!
 	TheoraVideoFrame* requestEmptyFrame();
+	//! Called by WorkerThreads to append a frame returned by requestEmptyFrame() once it's decoded
+	void push(TheoraVideoFrame* frame);
 
-	/** 
+	/**
 	    \brief set's the size of the frame queue.
-		
-		Beware, currently stored ready frames will be lost upon this call
+
+		Ready frames are kept in presentation order. If more frames are ready than the new
+		size, the queue holds on to them until they're popped but doesn't decode any
+		new ones before it's back within the size. Buffers of the surplus frames are
+		given back to the frame buffer pool as they become free, see setLimit().
+		Application buffers of frames that are removed are queued for the next frames
 	*/
 	void setSize(int n);
+	//! discards all frames and creates new ones, used when the frame layout changes. application buffers are given back
+	void reset();
 	//! return the size of the queue
 	int getSize();
+	/**
+	    \brief limits how many frames are decoded ahead without resizing the queue
+
+		Ready frames above the limit are kept, decoding resumes once enough of them are
+		popped. Buffers of frames above the limit are given back to the frame buffer
+		pool as the frames become free. 0 removes the limit
+	*/
+	void setLimit(int n);
+	//! returns the number of frames the queue fills, the limit or the size if there is none
+	int getLimit();
+	//! returns the size in bytes of a frame's own buffer
+	int getFrameBufferSize();
 
 	//! lock the queue's mutex manually
 	void lock();
@@ -11,6 +11,7 @@ the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
 
 #include "TheoraVideoManager.h"
 #include "TheoraVideoClip.h"
+#include "TheoraVideoClipView.h"
 #include "TheoraVideoFrame.h"
 
 #endif
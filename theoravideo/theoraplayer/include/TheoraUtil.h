@@ -22,6 +22,8 @@ the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
 std::string str(int i);
 std::string strf(float i);
 void _psleep(int milliseconds);
+//! returns the time in seconds since an arbitrary point, used for measuring intervals
+double _getTime();
 int _nextPow2(int x);
 
 #endif
\ No newline at end of file
@@ -11,6 +11,8 @@ the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
 #define _TheoraVideoClip_h
 
 #include <string>
+#include <vector>
+#include <atomic>
 #include "TheoraExport.h"
 
 // forward class declarations
@@ -22,6 +24,15 @@ class TheoraAudioInterface;
 class TheoraWorkerThread;
 class TheoraDataSource;
 class TheoraVideoFrame;
+class TheoraSeekIndex;
+class TheoraVideoClipView;
+class TheoraLoopCache;
+class TheoraVideoClip;
+
+//! see TheoraVideoManager::createVideoClipAsync(), success is false if the clip couldn't be loaded
+typedef void (*TheoraClipLoadedCallback)(TheoraVideoClip* clip,bool success,void* user_data);
+//! see TheoraVideoClip::setOutputBufferCallback(), buffer is one given to TheoraVideoClip::addOutputBuffer()
+typedef void (*TheoraOutputBufferCallback)(TheoraVideoClip* clip,unsigned char* buffer,void* user_data);
 
 /**
     format of the TheoraVideoFrame pixels. Affects decoding time
@@ -41,7 +52,12 @@ enum TheoraOutputMode
 	TH_AGREY3=10,
 	TH_YUV=11,
 	TH_YUVA=12,
-	TH_AYUV=13
+	TH_AYUV=13,
+	// planar 4:2:0, the Y, U and V planes are stored one after another at 1.5 bytes per pixel.
+	// use TheoraVideoFrame::getPlane() to access them, colour conversion is left to the GPU
+	TH_YUV420P=14,
+	// semi-planar 4:2:0, a Y plane followed by a plane of interleaved U,V pairs (1.5 bytes per pixel)
+	TH_NV12=15
 };
 
 /**
@@ -53,14 +69,30 @@ class TheoraPlayerExport TheoraVideoClip
 	friend class TheoraWorkerThread;
 	friend class TheoraVideoFrame;
 	friend class TheoraVideoManager;
+	friend class TheoraVideoClipView;
+	friend class TheoraFrameQueue;
 
 	TheoraFrameQueue* mFrameQueue;
+	//! views sharing the frame queue, see createView()
+	std::vector<TheoraVideoClipView*> mViews;
 	TheoraAudioInterface* mAudioInterface;
 	TheoraDataSource* mStream;
 
 	TheoraTimer *mTimer,*mDefaultTimer;
 
 	TheoraWorkerThread* mAssignedWorkerThread;
+	//! set by TheoraVideoManager::destroyVideoClip to prevent new work assignments
+	bool mDestroying;
+	//! set by TheoraVideoManager::_suspendClip while the frame queue is rebuilt, no work is assigned either
+	bool mSuspended;
+	//! set once load() finished, or failed for clips loaded by a worker thread
+	std::atomic<bool> mLoaded,mLoadFailed;
+	//! called by TheoraVideoManager::update() once a clip created with createVideoClipAsync() is loaded
+	TheoraClipLoadedCallback mLoadCallback;
+	void* mLoadCallbackData;
+	//! called when the clip gives an application output buffer back, see setOutputBufferCallback()
+	TheoraOutputBufferCallback mOutputBufferCallback;
+	void* mOutputBufferCallbackData;
 
 	// benchmark vars
 	int mNumDroppedFrames,mNumDisplayedFrames;
@@ -75,18 +107,81 @@ class TheoraPlayerExport TheoraVideoClip
     std::string mName;
 	int mWidth,mHeight,mStride;
 	unsigned long mNumFrames;
+	//! byte offset of the first page after the stream headers, loops restart reading there
+	unsigned long mDataOffset;
 
 	float mAudioGain; //! multiplier for audio samples. between 0 and 1
 	TheoraOutputMode mOutputMode,mRequestedOutputMode;
 	bool mAutoRestart;
 	bool mEndOfFile,mRestarted;
+	//! frame that decoder stripes are converted into, NULL if the frame is converted after decoding
+	TheoraVideoFrame* mStripeFrame;
+	//! number of rows converted from decoder stripes for the current packet
+	int mStripeRows;
+	//! display time of the last decoded frame, -1 if unknown (eg. after seeking)
+	float mPrevFrameTime;
 	int mIteration,mLastIteration; //! used to detect when the video restarted
 
 	float mUserPriority;
+	//! hint for TheoraVideoManager's frame memory budget, see setVisible()
+	bool mVisible;
+	//! scheduling deadline in TheoraVideoManager's clock, valid while the clip is in the work queue
+	float mDeadline;
+	//! position in TheoraVideoManager's work queue, -1 if not queued
+	int mScheduleIndex;
 
 	TheoraInfoStruct* mInfo; // a pointer is used to avoid having to include theora & vorbis headers
 
 	TheoraMutex* mAudioMutex; //! syncs audio decoding and extraction
+	TheoraMutex* mDemuxMutex; //! guards the ogg demuxer state and the data source
+	TheoraMutex* mPacketMutex; //! guards the queue of demuxed packets
+	TheoraMutex* mOutputBufferMutex; //! guards the queue of application output buffers
+
+	//! worker thread currently demuxing ahead for this clip, assigned by TheoraVideoManager
+	TheoraWorkerThread* mDemuxThread;
+	//! set when the demuxer reached the end of the data source (and auto restart is off)
+	bool mDemuxEOF;
+	//! max number of demuxed packets waiting to be decoded
+	int mNumPrecachedPackets;
+	//! number of bytes read from the data source at once chosen from the data rate, and the user's override (0 if none)
+	int mReadChunkSize,mUserReadChunkSize;
+
+	//! byte offsets of keyframes, filled in while demuxing. guarded by mDemuxMutex
+	TheoraSeekIndex* mSeekIndex;
+	//! set by scanSeekIndex(), idle worker threads index the rest of the file until this is reset
+	bool mScanSeekIndex;
+
+	//! converted frames of a whole pass through the file, see setLoopCacheBudget()
+	TheoraLoopCache* mLoopCache;
+	//! max number of bytes the loop cache may use, 0 if it's disabled
+	int mLoopCacheBudget;
+	//! set while loops are replayed from the loop cache instead of being decoded
+	bool mLoopCached;
+	//! index of the next frame replayed from the loop cache
+	int mLoopCacheFrame;
+
+	//! post-processing level used by the decoder and the level set by the user
+	int mPPLevel,mUserPPLevel,mMaxPPLevel;
+	//! set if the post-processing level follows the decoding load, see setAdaptivePostProcessing()
+	bool mAdaptivePP;
+	//! average time in seconds it takes to decode and convert a frame
+	float mDecodeTime;
+	//! frames decoded since the post-processing level last changed
+	int mPPFrames;
+	//! frames getNextFrame() dropped because they were decoded too late, and the count the governor saw last
+	int mNumLateFrames,mPPLateFrames;
+
+	//! set if frames compute a dirty mask against the previous frame, see setDirtyTileTracking()
+	bool mDirtyTileTracking;
+	//! frame queued last by the decoder, NULL after the frames were recreated
+	TheoraVideoFrame* mLastFrame;
+	//! serial number of the frame queued last
+	unsigned long mFrameSerial;
+
+	// pipeline benchmark vars
+	int mNumDecoderStalls,mNumDuplicateFrames;
+	unsigned long mNumOccupancySamples;
+	double mPacketOccupancySum,mFrameOccupancySum;
 
 	/**
 	 * Get the priority of a video clip. based on a forumula that includes user
@@ -98,14 +193,56 @@ class TheoraPlayerExport TheoraVideoClip
 	 */
 	int calculatePriority();
 	void readTheoraVorbisHeaders();
+	//! finds mDuration and mNumFrames from the last theora page, leaves the data source where it was
+	void readDuration();
+	//! sets mReadChunkSize from the clip's data rate
+	void _updateReadChunkSize();
 	long seekPage(long targetFrame,bool return_keyframe);
 	void doSeek(); //! called by WorkerThread to seek to mSeekPos
+	//! reads a chunk of data, demuxes its pages and queues theora packets. mDemuxMutex must be locked
 	bool _readData();
+	//! copies the ogg_packet's data and appends it to the packet queue
+	void _queuePacket(void* packet);
+	//! takes the next ogg_packet from the queue, the caller has to delete [] its data
+	bool _popPacket(void* packet);
+	void _clearPackets();
+	//! returns true if the packet queue is running low and an idle thread should demux ahead
+	bool _needsDemux();
+	//! demuxes until the packet queue is full, called by an idle worker thread
+	void _demuxAhead();
+	//! adds a page found at the given byte offset to the seek index. mDemuxMutex must be locked
+	void _indexPage(void* page,unsigned long offset);
+	//! indexes the next chunk of the file that isn't covered by the seek index yet
+	void _scanSeekIndex();
+	//! returns true if the seek index reaches the end of the file. mDemuxMutex must be locked
+	bool _isSeekIndexComplete();
+	//! called after each decoded frame, steps the adaptive post-processing level up or down
+	void _updatePostProcessing(float decodeTime);
+	//! returns the frame the next frame's dirty mask is computed against, or NULL if tracking is off
+	TheoraVideoFrame* _getDirtyReference(TheoraVideoFrame* frame);
+	//! numbers the frame and appends it to the frame queue
+	void _pushFrame(TheoraVideoFrame* frame);
+	//! fills the frame from the loop cache instead of decoding it
+	void _replayFrame(TheoraVideoFrame* frame);
+	//! gives the frame the next application output buffer, or its own buffer if there is none
+	void _attachOutputBuffer(TheoraVideoFrame* frame);
+	//! gives the queued application output buffers back
+	void _clearOutputBuffers();
+	//! takes the application buffer back from a frame that was popped, dropped or discarded and gives it to the application
+	void _releaseOutputBuffer(TheoraVideoFrame* frame);
+	//! takes the application buffer back from a frame that wasn't decoded into yet, it's used for the next frame
+	void _requeueOutputBuffer(TheoraVideoFrame* frame);
 	bool isBusy();
+	//! returns true if a worker thread can make progress on this clip (pending seek or room in the frame queue)
+	bool hasWork();
 
 	void load(TheoraDataSource* source);
+	//! loads a clip created with TheoraVideoManager::createVideoClipAsync(), called by a worker thread
+	void _loadAsync();
 
 	void _restart(); // resets the decoder and stream but leaves the frame queue intact
+	void _restartDecoder(); // resets the theora decoder, called when the decoder reaches a restart marker
+	void _restartDemuxer(); // rewinds the data source to the first data page and resets the ogg streams. mDemuxMutex must be locked
 public:
 	TheoraVideoClip(TheoraDataSource* data_source,
 		            TheoraOutputMode output_mode,
@@ -114,12 +251,62 @@ public:
 	~TheoraVideoClip();
 
 	std::string getName();
+	/**
+	    \brief returns true once the clip's headers are parsed and it can be played
+
+		Always true for clips created with TheoraVideoManager::createVideoClip().
+		Until a clip created with createVideoClipAsync() is loaded, only getName(),
+		isLoaded(), hasLoadFailed() and TheoraVideoManager::destroyVideoClip() may be used.
+		setReadChunkSize() and setPostProcessingLevel() may be called as well, they take
+		effect once the clip is loaded
+	 */
+	bool isLoaded() { return mLoaded.load(std::memory_order_acquire); }
+	//! returns true if loading the clip on a worker thread failed, the clip can only be destroyed then
+	bool hasLoadFailed() { return mLoadFailed.load(std::memory_order_acquire); }
 
 	//! benchmark function
 	int getNumDisplayedFrames() { return mNumDisplayedFrames; }
 	//! benchmark function
 	int getNumDroppedFrames() { return mNumDroppedFrames; }
 
+	/**
+	    \brief benchmark function, number of demuxed packets waiting to be decoded
+
+		Demuxing (reading the data source and splitting ogg pages into packets) runs
+		ahead of decoding on idle worker threads, the packet queue is the buffer between
+		the two stages, just like the frame queue is between decoding and display
+	 */
+	int getNumQueuedPackets();
+	//! benchmark function, average number of queued packets seen each time a frame was decoded
+	float getAveragePacketQueueOccupancy();
+	//! benchmark function, average number of ready frames seen each time a frame was decoded
+	float getAverageFrameQueueOccupancy();
+	//! benchmark function, number of times the decoder ran out of packets and had to demux itself
+	int getNumDecoderStalls() { return mNumDecoderStalls; }
+	/**
+	    \brief benchmark function, number of duplicate frames that were skipped
+
+		Encoders mark frames that repeat the previous picture, as is common in slide
+		shows and UI videos. These aren't converted or queued at all, the previous
+		frame simply stays on display until the next different frame is due. Frame
+		numbers of queued frames skip the duplicates
+	 */
+	int getNumDuplicateFrames() { return mNumDuplicateFrames; }
+
+	//! max number of demuxed packets that are buffered ahead of decoding, 32 by default
+	void setNumPrecachedPackets(int n);
+	int getNumPrecachedPackets();
+
+	/**
+	    \brief set the number of bytes read from the data source at once
+
+		By default this is chosen from the clip's data rate, so that high bitrate clips
+		aren't read in thousands of small pieces per second. 0 restores the default
+	 */
+	void setReadChunkSize(int size);
+	//! returns the number of bytes read from the data source at once
+	int getReadChunkSize();
+
 	//! return width in pixels of the video clip
 	int getWidth() { return mWidth; }
 	//! return height in pixels of the video clip
@@ -142,6 +329,8 @@ public:
 
 	//! used by TheoraWorkerThread, do not call directly
 	void decodeNextFrame();
+	//! internal function called from the decoder's stripe callback, do not call directly
+	void _decodeStripe(void* yuv,int yfrag0,int yfrag_end);
 
 	//! advance time. TheoraVideoManager calls this
 	void update(float time_increase);
@@ -179,13 +368,26 @@ public:
 	/**
 	    \brief resize the frame queues
 
-		Warning: this call discards ready frames in the frame queue
+		Ready frames are kept. When shrinking below the number of ready frames, decoding
+		pauses until enough of them are displayed. Can be used to deepen the queue
+		during load spikes and to shorten it again for lower latency
 	 */
 	void setNumPrecachedFrames(int n);
 	//! returns the size of the frame queue
 	int getNumPrecachedFrames();
 	//! returns the number of ready frames in the frame queue
 	int getNumReadyFrames();
+	/**
+	    \brief returns how many frames are decoded ahead
+
+		This is the size of the frame queue unless TheoraVideoManager's frame memory
+		budget limits the clip to fewer frames, see TheoraVideoManager::setFrameMemoryBudget()
+	 */
+	int getEffectiveNumPrecachedFrames();
+	//! internal function, do not use directly. limits the frames decoded ahead, 0 means no limit
+	void _setFrameLimit(int n);
+	//! internal function, do not use directly. returns the size of a frame's buffer in bytes
+	int _getFrameBufferSize();
 
 	//! if you want to adjust the audio gain. range [0,1]
 	void setAudioGain(float gain);
@@ -195,15 +397,125 @@ public:
 	void setAutoRestart(bool value);
 	bool getAutoRestart() { return mAutoRestart; }
 
+	/**
+	    \brief compute which parts of each frame changed
+
+		When on, every frame compares its picture with the previous frame in tiles of
+		TH_DIRTY_TILE_SIZE pixels, right after the rows are converted. Consumers that
+		keep the previous picture around (eg. in a texture) can then update only the
+		tiles that changed, see TheoraVideoFrame::getDirtyReference(). Off by default,
+		the comparison reads the previous frame as well
+	 */
+	void setDirtyTileTracking(bool value);
+	bool getDirtyTileTracking() { return mDirtyTileTracking; }
+
+	/**
+	    \brief set the decoder's post-processing (deblocking) level
 
+		0 (the default) disables post-processing, higher levels up to
+		getMaxPostProcessingLevel() reduce blocking artifacts at the cost of decoding
+		time. Ignored while adaptive post-processing is on
+	 */
+	void setPostProcessingLevel(int level);
+	//! returns the post-processing level the decoder currently uses
+	int getPostProcessingLevel() { return mPPLevel; }
+	//! returns the highest post-processing level the decoder supports
+	int getMaxPostProcessingLevel() { return mMaxPPLevel; }
+	/**
+	    \brief let the post-processing level follow the decoding load
+
+		The level is stepped up while decoding a frame takes well under the frame
+		interval and stepped down when decoding gets close to it or frames are
+		displayed late, so post-processing is given up before frames are dropped.
+		Levels change at most once every few frames and stepping up waits longer
+		than stepping down, so the level doesn't flicker on a borderline load
+	 */
+	void setAdaptivePostProcessing(bool value);
+	bool getAdaptivePostProcessing() { return mAdaptivePP; }
 
 	/**
-	    TODO: user priority. Useful only when more than one video is being decoded
+	    \brief keep the converted frames of short auto restarting clips in memory
+
+		With a budget (in bytes) set, every converted frame of a pass through the file
+		is copied aside. If the whole clip fits in the budget, further loops are played
+		from memory without any reading or decoding. If it doesn't, the copies are freed
+		and the clip keeps decoding every loop. Lowering the budget below the size of
+		the cached frames switches back to decoding at the end of the current loop.
+		0 (the default) disables the cache. Clips with an audio interface always decode
+	 */
+	void setLoopCacheBudget(int bytes);
+	int getLoopCacheBudget() { return mLoopCacheBudget; }
+	//! returns the number of bytes used by cached frames
+	int getLoopCacheSize();
+	//! returns true if loops are currently played from the loop cache
+	bool isLoopCached() { return mLoopCached; }
+
+	/**
+	    \brief convert frames straight into memory owned by the application
+
+		Queues a buffer (eg. a persistently mapped pixel buffer or staging area) that the
+		next decoded frame is converted into, saving the copy from the frame's own buffer.
+		pitch is the size of a row in bytes, it has to hold at least getWidth() pixels of
+		the current output mode. Planes of planar modes follow each other at that pitch,
+		laid out like TheoraVideoFrame::getPlane() describes, so the pitch has to be an
+		even number of pixels.
+
+		Buffers are used in the order they were added. A frame that gets one keeps it
+		until it was displayed: once popFrame() and the clip's views popped it, the buffer
+		holds that frame and belongs to the application again. Frames that are never
+		displayed give their buffers back too: frames dropped because they're late or
+		past the end of the clip, and frames flushed by seek() and restart(). Frames
+		decoded while no buffer is queued use their own. setOutputMode(),
+		clearOutputBuffers() and destroying the clip give all buffers back, including
+		the ones of frames that weren't displayed. See setOutputBufferCallback() to
+		find out when a buffer is given back.
+		returns false if the pitch is invalid
+	 */
+	bool addOutputBuffer(unsigned char* buffer,int pitch);
+	//! returns the number of added output buffers no frame was decoded into yet
+	int getNumOutputBuffers();
+	//! gives all output buffers back to the application, undisplayed frames are discarded
+	void clearOutputBuffers();
+	/**
+	    \brief set a function that's called whenever the clip gives an output buffer back
+
+		Called for every buffer added with addOutputBuffer() once the clip is done with it:
+		after its frame was popped by popFrame() and all views, when the frame was dropped
+		or flushed, and for every buffer setOutputMode() or clearOutputBuffers() give back.
+		Not called when the clip is destroyed. The callback runs on the thread that
+		released the buffer, which can be a worker thread (eg. when seeking), and may
+		queue the buffer again with addOutputBuffer(). Set it before adding buffers.
+	 */
+	void setOutputBufferCallback(TheoraOutputBufferCallback callback,void* user_data=NULL);
+
+
+
+	/**
+	    \brief set user priority, 1 by default
+
+		Useful only when more than one video is being decoded. Time left until a clip
+		runs out of decoded frames is divided by its priority when scheduling work,
+		so a clip with priority 2 is decoded as if its deadline was twice as close.
 	 */
 	void setPriority(float priority);
 	float getPriority();
 
-	//! Used by TheoraVideoManager to schedule work
+	/**
+	    \brief tell the manager whether the clip is currently on screen, true by default
+
+		With a frame memory budget set, clips that aren't visible only get the minimum
+		number of precached frames and leave the rest of the budget to the visible ones.
+		The clip keeps playing either way
+	 */
+	void setVisible(bool visible);
+	bool isVisible() { return mVisible; }
+
+	/**
+	    \brief Used by TheoraVideoManager to schedule work
+
+		returns the time (in seconds) left until the clip runs out of decoded frames,
+		weighted by user priority. Clips with lower values are decoded first
+	 */
 	float getPriorityIndex();
 
 	//! get the current time index from the timer object
@@ -234,6 +546,38 @@ public:
     float getPlaybackSpeed();
 	//! seek to a given time position
 	void seek(float time);
+
+	/**
+	    \brief create another consumer of this clip's decoded frames
+
+		Useful for showing the same video in several places: views share this clip's
+		decoder, data source and frame queue instead of decoding the file again.
+		See TheoraVideoClipView for details. Views are destroyed along with the clip
+	 */
+	TheoraVideoClipView* createView();
+	void destroyView(TheoraVideoClipView* view);
+	int getNumViews() { return mViews.size(); }
+
+	/**
+	    \brief index the whole file in the background
+
+		Seeking looks up the keyframe's location in an index of theora pages, which
+		is filled in as the clip plays. Parts of the file that haven't been played
+		yet are found by bisecting the file, which takes many reads. This makes
+		idle worker threads scan the rest of the file so every seek is a single read.
+	 */
+	void scanSeekIndex();
+	//! returns true if the seek index covers the whole file
+	bool isSeekIndexComplete();
+	/**
+	    \brief save the seek index to a (sidecar) file
+
+		The next time the clip is opened, loadSeekIndex() can restore it so seeking
+		doesn't have to wait for the file to be played or scanned again
+	 */
+	bool saveSeekIndex(std::string filename);
+	//! load a seek index saved by saveSeekIndex(), returns false if the file is missing or belongs to a different video
+	bool loadSeekIndex(std::string filename);
 };
 
 #endif
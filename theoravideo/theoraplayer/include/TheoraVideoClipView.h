@@ -0,0 +1,59 @@
+/************************************************************************************
+This source file is part of the Theora Video Playback Library
+For latest info, see http://libtheoraplayer.sourceforge.net/
+*************************************************************************************
+Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
+This program is free software; you can redistribute it and/or modify it under
+the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
+*************************************************************************************/
+#ifndef _TheoraVideoClipView_h
+#define _TheoraVideoClipView_h
+
+#include <atomic>
+#include "TheoraExport.h"
+
+class TheoraVideoClip;
+class TheoraVideoFrame;
+
+/**
+	An extra consumer of a TheoraVideoClip's decoded frames, eg. for showing the same
+	video on several screens. Views have their own read cursor into the clip's frame
+	queue, but no decoder, data source or frames of their own, so any number of them
+	costs about as much as the clip alone.
+
+	Views follow the clip's timer, so playback is controlled through the clip.
+	Every view has to pop its frames, just like the clip, or it holds up decoding.
+	Create views with TheoraVideoClip::createView().
+*/
+class TheoraPlayerExport TheoraVideoClipView
+{
+	friend class TheoraVideoClip;
+
+	TheoraVideoClip* mClip;
+	//! index of the view's next frame in the clip's frame queue
+	std::atomic<unsigned int> mHead;
+	//! timer position seen by the last getNextFrame() call, used to detect when the clip loops
+	float mLastTime;
+	// benchmark vars
+	int mNumDroppedFrames,mNumDisplayedFrames;
+
+	TheoraVideoClipView(TheoraVideoClip* clip);
+	~TheoraVideoClipView();
+public:
+	//! returns the clip this is a view of
+	TheoraVideoClip* getClip() { return mClip; }
+
+	//! benchmark function
+	int getNumDisplayedFrames() { return mNumDisplayedFrames; }
+	//! benchmark function
+	int getNumDroppedFrames() { return mNumDroppedFrames; }
+
+	//! returns the view's first frame that is due for display, or NULL. works like TheoraVideoClip::getNextFrame()
+	TheoraVideoFrame* getNextFrame();
+	//! pop the frame returned by getNextFrame() once it's displayed
+	void popFrame();
+	//! returns the number of ready frames this view hasn't displayed yet
+	int getNumReadyFrames();
+};
+
+#endif
@@ -11,6 +11,9 @@ the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
 
 #include <TheoraExport.h>
 
+//! width and height in pixels of the tiles of a frame's dirty mask
+#define TH_DIRTY_TILE_SIZE 64
+
 class TheoraVideoClip;
 /**
 	
@@ -18,8 +21,23 @@ class TheoraVideoClip;
 class TheoraPlayerExport TheoraVideoFrame
 {
 	TheoraVideoClip* mParent;
+	//! the buffer the frame is converted into, either mOwnBuffer or one given by the application
 	unsigned char* mBuffer;
+	unsigned char* mOwnBuffer;
+	//! size of mOwnBuffer, taken from the manager's frame buffer pool on first use
+	int mBufferSize;
+	//! stride of mBuffer in pixels
+	int mStride;
+	//! set if mBuffer was given by the application, see TheoraVideoClip::addOutputBuffer()
+	bool mExternalBuffer;
 	unsigned long mFrameNumber;
+	//! number of the picture, and of the picture the dirty mask was computed against
+	unsigned long mSerial,mDirtyReference;
+	//! one byte per tile, set if the tile differs from the reference frame. allocated on first use
+	unsigned char* mDirtyTiles;
+	int mNumTilesX,mNumTilesY,mNumDirtyTiles;
+	//! frame the dirty mask is being computed against while the frame is filled in
+	TheoraVideoFrame* mReference;
 
 public:
 	//! global time in seconds this frame should be displayed on
@@ -38,16 +56,101 @@ public:
 	void _setFrameNumber(int number) { mFrameNumber=number; }
 	//! returns the frame number of this frame in the theora stream
 	int getFrameNumber() { return mFrameNumber; }
+	//! internal function, do not use directly
+	void _setSerial(unsigned long serial) { mSerial=serial; }
+	/**
+	    \brief returns a number identifying the picture in this frame
+
+		Every frame a clip queues gets a higher number than the one before it.
+		Compare with getDirtyReference() to find out if only the dirty tiles need updating
+	*/
+	unsigned long getSerial() { return mSerial; }
+
+	/**
+	    \brief returns the serial of the frame the dirty mask was computed against
+
+		If the picture currently on display is the frame with this serial, only the
+		tiles marked dirty have to be updated (eg. uploaded to a texture). Otherwise,
+		or if this is 0, the whole frame has to be updated.
+		See TheoraVideoClip::setDirtyTileTracking()
+	*/
+	unsigned long getDirtyReference() { return mDirtyReference; }
+	//! returns the number of tiles in a row of the dirty mask
+	int getNumTilesX() { return mNumTilesX; }
+	//! returns the number of rows of tiles in the dirty mask
+	int getNumTilesY() { return mNumTilesY; }
+	//! returns true if the TH_DIRTY_TILE_SIZE sized tile at column x, row y changed
+	bool isTileDirty(int x,int y) { return mDirtyReference == 0 || mDirtyTiles[y*mNumTilesX+x] != 0; }
+	//! returns the number of tiles that changed
+	int getNumDirtyTiles() { return mNumDirtyTiles; }
 
 	void clear();
 
 	int getWidth();
+	//! returns the stride of the frame buffer in pixels, see TheoraVideoClip::getStride()
 	int getStride();
 	int getHeight();
 
 	unsigned char* getBuffer();
+	//! returns the size in bytes of a frame buffer laid out with the clip's stride, including all planes
+	int getBufferSize() { return mBufferSize; }
+	//! returns true if the frame was converted into a buffer added with TheoraVideoClip::addOutputBuffer()
+	bool hasExternalBuffer() { return mExternalBuffer; }
+
+	/**
+	    \brief returns a plane of the frame buffer
+
+		For planar output modes (TH_YUV420P) plane 0 is luma (Y), 1 is Cb (U) and 2 is Cr (V).
+		TH_NV12 has the luma plane and plane 1 with interleaved U,V pairs.
+		Interleaved modes only have plane 0, which is the same as getBuffer(), other planes are NULL
+	*/
+	unsigned char* getPlane(int plane);
+	//! returns the number of bytes between two rows of a plane
+	int getPlaneStride(int plane);
+	//! returns the width of a plane in pixels (U,V pairs for NV12), chroma planes are half the frame size
+	int getPlaneWidth(int plane);
+	//! returns the height of a plane in pixels, chroma planes are half the frame size
+	int getPlaneHeight(int plane);
 
 	//! Called by TheoraVideoClip to decode a YUV buffer onto itself
 	void decode(void* yuv);
+	/**
+	    \brief Called by TheoraVideoClip to convert rows [y0,y1) of a YUV buffer
+
+		Used to convert stripes while the decoder is still working on the rest of
+		the frame. Doesn't mark the frame as ready
+	*/
+	void decodeRows(void* yuv,int y0,int y1);
+	/**
+	    \brief Called by TheoraVideoClip before filling in the frame
+
+		Starts a new dirty mask against the reference frame, or marks all tiles
+		dirty if reference is NULL
+	*/
+	void _beginDirtyTiles(TheoraVideoFrame* reference);
+	//! Called by TheoraVideoClip to compare rows [y0,y1) with the reference frame once they're filled in
+	void _updateDirtyTiles(int y0,int y1);
+	/**
+	    \brief Called by TheoraVideoClip before filling in the frame
+
+		Makes the frame use an application's buffer with the given stride (in pixels),
+		or its own buffer if buffer is NULL
+	*/
+	void _setOutputBuffer(unsigned char* buffer,int stride);
+	//! Called by TheoraFrameQueue when the application gets its buffer back, doesn't allocate the frame's own buffer
+	void _detachOutputBuffer();
+	//! returns true if the frame holds a buffer of its own, whether it's in use or not
+	bool _hasOwnBuffer() { return mOwnBuffer != 0; }
+	//! Called by TheoraFrameQueue to move the own buffer of a free frame to this one, which must not have one
+	void _takeOwnBuffer(TheoraVideoFrame* frame);
+	//! Called by TheoraFrameQueue to give the own buffer of a free frame back to the frame buffer pool
+	void _freeOwnBuffer();
+	//! Called by TheoraVideoClip to save the picture into a buffer laid out with the clip's stride
+	void _copyTo(unsigned char* data);
+	//! Called by TheoraVideoClip to fill in the frame from a buffer laid out with the clip's stride
+	void _copyFrom(const unsigned char* data);
+protected:
+	//! copies all planes between buffers with different strides (in pixels)
+	void _copyPlanes(unsigned char* dst,int dstStride,const unsigned char* src,int srcStride);
 };
 #endif
@@ -20,8 +20,21 @@ the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
 // forward class declarations
 class TheoraWorkerThread;
 class TheoraMutex;
+class TheoraEvent;
+class TheoraConversionJob;
 class TheoraDataSource;
 class TheoraAudioInterfaceFactory;
+class TheoraFramePool;
+
+//! frame buffer pool counters, see TheoraVideoManager::getFrameBufferPoolStats()
+struct TheoraFramePoolStats
+{
+	//! number of buffers allocated from the system, taken from the pool and freed to the system
+	int numAllocations,numReuses,numFrees;
+	//! bytes of buffers used by frames, kept in the pool and the most ever allocated at once
+	size_t bytesInUse,bytesIdle,peakBytes;
+};
+
 /**
 	This is the main singleton class that handles all playback/sync operations
 */
@@ -36,18 +49,59 @@ protected:
 	ThreadList mWorkerThreads;
 	//! stores pointers to created video clips
 	ClipList mClips;
+	//! binary min-heap of idle clips that have work, ordered by TheoraVideoClip::mDeadline
+	ClipList mWorkQueue;
+	//! clips created with createVideoClipAsync() waiting for a worker thread to load them
+	ClipList mLoadQueue;
+	//! clips loaded by worker threads, their callbacks are called on the next update()
+	ClipList mLoadedClips;
+	//! sum of all update() time increases, used as the time base for scheduling deadlines
+	float mClock;
+	//! frame conversions with row bands for idle worker threads, see _runConversionJob()
+	std::vector<TheoraConversionJob*> mConversionJobs;
 	int mDefaultNumPrecachedFrames;
 
 	TheoraMutex* mWorkMutex;
+	//! idle worker threads sleep on this event until a clip has work for them
+	TheoraEvent* mWorkEvent;
 	TheoraAudioInterfaceFactory* mAudioFactory;
+	//! frame buffers shared by all clips
+	TheoraFramePool* mFramePool;
+	//! max bytes of decoded frames of all clips, 0 means no limit
+	size_t mFrameMemoryBudget;
 
 	void createWorkerThreads(int n);
 	void destroyWorkerThreads();
 
 	/**
-	 * Called by TheoraWorkerThread to request a TheoraVideoClip instance to work on decoding
+	 * Called by TheoraWorkerThread to request a TheoraVideoClip instance to work on decoding.
+	 * Clips are handed out earliest deadline first, see TheoraVideoClip::getPriorityIndex()
 	 */
 	TheoraVideoClip* requestWork(TheoraWorkerThread* caller);
+	//! Called by TheoraWorkerThread when it's done with a clip it got from requestWork()
+	void finishWork(TheoraVideoClip* clip);
+	//! Called by TheoraWorkerThreads without decoding work, returns a clip that needs to be loaded or NULL
+	TheoraVideoClip* requestLoadWork(TheoraWorkerThread* caller);
+	//! Called by TheoraWorkerThread when it's done loading a clip it got from requestLoadWork()
+	void finishLoadWork(TheoraVideoClip* clip);
+	//! Called by idle TheoraWorkerThreads, returns a clip whose packet queue is running low or NULL
+	TheoraVideoClip* requestDemuxWork(TheoraWorkerThread* caller);
+	//! Called by TheoraWorkerThread when it's done demuxing a clip it got from requestDemuxWork()
+	void finishDemuxWork(TheoraVideoClip* clip);
+	//! Called by idle TheoraWorkerThreads, returns a conversion job they can help with or NULL
+	TheoraConversionJob* requestConversionJob();
+	//! Called by TheoraWorkerThread after helping with a job returned by requestConversionJob()
+	void finishConversionJob(TheoraConversionJob* job);
+
+	//! (re)inserts an idle clip with work into the work queue with a fresh deadline. mWorkMutex must be locked
+	void scheduleClip(TheoraVideoClip* clip);
+	//! removes a clip from the work queue, if it's queued. mWorkMutex must be locked
+	void unscheduleClip(TheoraVideoClip* clip);
+	//! splits the frame memory budget into per clip frame limits, called on every update()
+	void distributeFrameMemory();
+	void _heapSwap(int a,int b);
+	void _heapUp(int i);
+	void _heapDown(int i);
 public:
 	TheoraVideoManager(int num_worker_threads=1);
 	virtual ~TheoraVideoManager();
@@ -62,6 +116,23 @@ public:
 
 	TheoraVideoClip* createVideoClip(std::string filename,TheoraOutputMode output_mode=TH_RGB,int numPrecachedOverride=0,bool usePower2Stride=0);
 	TheoraVideoClip* createVideoClip(TheoraDataSource* data_source,TheoraOutputMode output_mode=TH_RGB,int numPrecachedOverride=0,bool usePower2Stride=0);
+	/**
+		\brief creates a clip without blocking the calling thread
+
+		Opening the file, parsing the headers, finding the duration and allocating the
+		frame queue are done by a worker thread once it has no frames to decode. The
+		returned clip can't be used until TheoraVideoClip::isLoaded() returns true,
+		except for being destroyed. The callback (if any) is called from update() on
+		the next update after loading finished, with success set to false if the file
+		couldn't be loaded. A clip that failed to load has to be destroyed with
+		destroyVideoClip(). The audio interface factory is called from the worker thread
+	 */
+	TheoraVideoClip* createVideoClipAsync(std::string filename,TheoraOutputMode output_mode=TH_RGB,
+	                                      TheoraClipLoadedCallback callback=NULL,void* user_data=NULL,
+	                                      int numPrecachedOverride=0,bool usePower2Stride=0);
+	TheoraVideoClip* createVideoClipAsync(TheoraDataSource* data_source,TheoraOutputMode output_mode=TH_RGB,
+	                                      TheoraClipLoadedCallback callback=NULL,void* user_data=NULL,
+	                                      int numPrecachedOverride=0,bool usePower2Stride=0);
 
 	void update(float time_increase);
 
@@ -73,6 +144,63 @@ public:
 	int getNumWorkerThreads();
 	void setNumWorkerThreads(int n);
 
+	/**
+		\brief wakes up idle worker threads
+
+		Called internally whenever a clip gets new work (seek, free frame, restart etc.)
+		or its deadline changes, so it can be rescheduled before the threads wake up.
+	 */
+	void _signalWork(TheoraVideoClip* clip=NULL);
+	/**
+		\brief keeps worker threads away from a clip while its frames are rebuilt
+
+		Called internally, returns once the worker thread decoding the clip (if any)
+		is done with it. No worker thread takes the clip until _resumeClip() is called.
+	 */
+	void _suspendClip(TheoraVideoClip* clip);
+	//! lets worker threads take a clip suspended with _suspendClip() again
+	void _resumeClip(TheoraVideoClip* clip);
+	/**
+		\brief converts a frame with the help of idle worker threads
+
+		Called internally by the worker thread decoding a frame, returns after all
+		bands of the job have been converted.
+	 */
+	void _runConversionJob(TheoraConversionJob* job);
+
+	//! internal function, do not use directly
+	TheoraFramePool* _getFramePool() { return mFramePool; }
+
+	/**
+		\brief limit the memory used by the frame queues of all clips together, 0 (default) means no limit
+
+		Every clip gets at least two precached frames (one if it isn't visible, see
+		TheoraVideoClip::setVisible()), the rest of the budget is divided between the
+		visible, playing clips by priority, up to the size of their frame queues.
+		Frames that are already decoded are never discarded when a clip's share
+		shrinks, it just stops decoding ahead until it's back within its share.
+		Unused buffers in the frame buffer pool count against the budget as well,
+		the pool only keeps what's left after the clips' shares.
+		See TheoraVideoClip::getEffectiveNumPrecachedFrames()
+	 */
+	void setFrameMemoryBudget(size_t bytes);
+	size_t getFrameMemoryBudget() { return mFrameMemoryBudget; }
+
+	/**
+		\brief set the max bytes of unused frame buffers kept for reuse, 64 MB by default
+
+		Frame buffers of destroyed clips and recreated frame queues are kept and handed
+		to the next frames of a similar size, buffers returned while the limit is reached
+		are freed. Lowering the limit frees unused buffers right away, 0 disables pooling.
+		With a frame memory budget the pool keeps at most what the clips' shares leave
+		over, see setFrameMemoryBudget()
+	 */
+	void setFrameBufferPoolLimit(size_t bytes);
+	size_t getFrameBufferPoolLimit();
+	//! frees all frame buffers that aren't used by a frame
+	void trimFrameBufferPool();
+	TheoraFramePoolStats getFrameBufferPoolStats();
+
 	void setDefaultNumPrecachedFrames(int n) { mDefaultNumPrecachedFrames=n; }
 	int getDefaultNumPrecachedFrames() { return mDefaultNumPrecachedFrames; }
 
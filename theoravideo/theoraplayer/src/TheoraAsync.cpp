@@ -7,9 +7,15 @@ This program is free software; you can redistribute it and/or modify it under
 the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
 *************************************************************************************/
 #include <stdio.h>
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
 #include "TheoraAsync.h"
 
 #ifdef _WIN32
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600 // condition variables
+#endif
 #include <windows.h>
 
 unsigned long WINAPI theoraAsync_Call(void* param)
@@ -65,6 +71,108 @@ void TheoraMutex::unlock()
 #endif
 }
 
+TheoraEvent::TheoraEvent()
+{
+	mCount=0;
+#ifdef _WIN32
+	mMutex=new CRITICAL_SECTION;
+	mCondition=new CONDITION_VARIABLE;
+	InitializeCriticalSection((CRITICAL_SECTION*) mMutex);
+	InitializeConditionVariable((CONDITION_VARIABLE*) mCondition);
+#else
+    pthread_mutex_init(&mMutex,0);
+    pthread_cond_init(&mCondition,0);
+#endif
+}
+
+TheoraEvent::~TheoraEvent()
+{
+#ifdef _WIN32
+	DeleteCriticalSection((CRITICAL_SECTION*) mMutex);
+	delete (CRITICAL_SECTION*) mMutex;
+	delete (CONDITION_VARIABLE*) mCondition;
+#else
+    pthread_cond_destroy(&mCondition);
+    pthread_mutex_destroy(&mMutex);
+#endif
+}
+
+unsigned int TheoraEvent::getCount()
+{
+	unsigned int count;
+#ifdef _WIN32
+	EnterCriticalSection((CRITICAL_SECTION*) mMutex);
+	count=mCount;
+	LeaveCriticalSection((CRITICAL_SECTION*) mMutex);
+#else
+    pthread_mutex_lock(&mMutex);
+	count=mCount;
+    pthread_mutex_unlock(&mMutex);
+#endif
+	return count;
+}
+
+void TheoraEvent::signal()
+{
+#ifdef _WIN32
+	EnterCriticalSection((CRITICAL_SECTION*) mMutex);
+	mCount++;
+	LeaveCriticalSection((CRITICAL_SECTION*) mMutex);
+	WakeAllConditionVariable((CONDITION_VARIABLE*) mCondition);
+#else
+    pthread_mutex_lock(&mMutex);
+	mCount++;
+    pthread_cond_broadcast(&mCondition);
+    pthread_mutex_unlock(&mMutex);
+#endif
+}
+
+bool TheoraEvent::wait(unsigned int count,int timeout)
+{
+	bool signaled=1;
+#ifdef _WIN32
+	EnterCriticalSection((CRITICAL_SECTION*) mMutex);
+	DWORD start=GetTickCount(),elapsed;
+	while (mCount == count)
+	{
+		if (timeout < 0) SleepConditionVariableCS((CONDITION_VARIABLE*) mCondition,(CRITICAL_SECTION*) mMutex,INFINITE);
+		else
+		{
+			elapsed=GetTickCount()-start;
+			if (elapsed >= (DWORD) timeout ||
+				!SleepConditionVariableCS((CONDITION_VARIABLE*) mCondition,(CRITICAL_SECTION*) mMutex,timeout-elapsed))
+			{
+				signaled=(mCount != count);
+				break;
+			}
+		}
+	}
+	LeaveCriticalSection((CRITICAL_SECTION*) mMutex);
+#else
+	timespec deadline;
+	if (timeout >= 0)
+	{
+		timeval now;
+		gettimeofday(&now,0);
+		long long ns=(long long) now.tv_usec*1000+(long long) timeout*1000000;
+		deadline.tv_sec=now.tv_sec+(time_t) (ns/1000000000);
+		deadline.tv_nsec=(long) (ns%1000000000);
+	}
+    pthread_mutex_lock(&mMutex);
+	while (mCount == count)
+	{
+		if (timeout < 0) pthread_cond_wait(&mCondition,&mMutex);
+		else if (pthread_cond_timedwait(&mCondition,&mMutex,&deadline))
+		{
+			signaled=(mCount != count);
+			break;
+		}
+	}
+    pthread_mutex_unlock(&mMutex);
+#endif
+	return signaled;
+}
+
 
 TheoraThread::TheoraThread()
 {
@@ -91,6 +199,11 @@ void TheoraThread::startThread()
 #endif
 }
 
+void TheoraThread::stopThread()
+{
+	mThreadRunning=false;
+}
+
 void TheoraThread::waitforThread()
 {
 	mThreadRunning=false;
@@ -0,0 +1,110 @@
+/************************************************************************************
+This source file is part of the Theora Video Playback Library
+For latest info, see http://libtheoraplayer.sourceforge.net/
+*************************************************************************************
+Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
+This program is free software; you can redistribute it and/or modify it under
+the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
+*************************************************************************************/
+#ifndef _TheoraConversion_h
+#define _TheoraConversion_h
+
+#include <atomic>
+#include <theora/theoradec.h>
+#include "TheoraVideoClip.h"
+
+/**
+	Internal colour conversion interface, shared between the reference (C) converters
+	in TheoraVideoFrame.cpp and the SIMD kernels that replace them at runtime.
+*/
+
+//! number of entries in the conversion function tables (output modes are 1 based)
+#define TH_NUM_OUTPUT_MODES 16
+
+//! fixed point (13 bit) conversion coefficients, see createYUVtoRGBtables()
+#define TH_YUV_Y  9536
+#define TH_YUV_RV 13075
+#define TH_YUV_GU 3204
+#define TH_YUV_GV 6661
+#define TH_YUV_BU 16532
+
+//! converts a decoded YUV 4:2:0 image into 'out', stride is in pixels
+typedef void (*TheoraConversionFunction)(th_img_plane* yuv,unsigned char* out,int stride);
+
+enum TheoraCPUFeature
+{
+	TH_CPU_SSE2=1,
+	TH_CPU_AVX2=2,
+	TH_CPU_NEON=4
+};
+
+//! returns a mask of TheoraCPUFeature flags supported by the CPU and the OS
+int _getCPUFeatures();
+
+//! plain C converters, always available and used as reference for the SIMD kernels
+extern TheoraConversionFunction reference_conversion_functions[TH_NUM_OUTPUT_MODES];
+//! converters currently in use, filled in by selectConversionFunctions()
+extern TheoraConversionFunction conversion_functions[TH_NUM_OUTPUT_MODES];
+
+//! returns the number of bytes per pixel for a given output mode (of the luma plane for planar modes)
+int _getBytesPerPixel(TheoraOutputMode mode);
+//! returns the number of planes of the output mode, 1 for interleaved modes
+int _getNumPlanes(TheoraOutputMode mode);
+//! copies width x height bytes of an image plane
+void _copyPlane(th_img_plane* plane,unsigned char* out,int stride);
+
+/**
+	converts the columns [x,width) of the image using the reference converter.
+	SIMD kernels use this for the remaining pixels that don't fill a whole vector.
+	x has to be even
+*/
+void _convertTail(TheoraOutputMode mode,th_img_plane* yuv,unsigned char* out,int stride,int x);
+
+/**
+	these fill the table with the kernels of a given instruction set and return true,
+	or return false if the instruction set wasn't available at compile time
+*/
+bool _getSSE2ConversionFunctions(TheoraConversionFunction* table);
+bool _getAVX2ConversionFunctions(TheoraConversionFunction* table);
+bool _getNEONConversionFunctions(TheoraConversionFunction* table);
+
+//! fills conversion_functions with the best kernels for the given features, returns their name
+const char* _selectConversionFunctions(int cpu_features);
+
+/**
+	converts rows [y0,y1) of the image, used for row bands and decoder stripes.
+	y0 has to be even, only works with single plane output modes
+*/
+void _convertRows(TheoraOutputMode mode,th_img_plane* yuv,unsigned char* out,int stride,int y0,int y1);
+
+//! frames with fewer rows per band than this are converted in one go
+#define TH_MIN_CONVERSION_BAND_HEIGHT 32
+
+//! returns how many row bands a frame should be split into for parallel conversion, 1 means don't split
+int _getNumConversionBands(TheoraOutputMode mode,int height);
+
+/**
+	A frame conversion split into horizontal bands, so that idle worker threads can
+	help converting large frames. Bands are claimed with an atomic counter, see
+	TheoraVideoManager::_runConversionJob()
+*/
+class TheoraConversionJob
+{
+protected:
+	TheoraOutputMode mMode;
+	th_img_plane mPlanes[3];
+	unsigned char* mOut;
+	int mStride,mBandHeight,mNumBands;
+	std::atomic<int> mNextBand;
+public:
+	//! number of threads other than the owner running this job, guarded by TheoraVideoManager's work mutex
+	int mNumHelpers;
+
+	TheoraConversionJob(TheoraOutputMode mode,th_img_plane* yuv,unsigned char* out,int stride,int nBands);
+	//! returns true if some bands haven't been claimed yet
+	bool hasBands();
+	//! claims and converts bands until there are none left
+	void run();
+};
+
+#endif
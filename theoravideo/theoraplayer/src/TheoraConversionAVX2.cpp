@@ -0,0 +1,115 @@
+/************************************************************************************
+This source file is part of the Theora Video Playback Library
+For latest info, see http://libtheoraplayer.sourceforge.net/
+*************************************************************************************
+Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
+This program is free software; you can redistribute it and/or modify it under
+the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
+*************************************************************************************/
+#include "TheoraConversion.h"
+
+// this file is compiled with AVX2 code generation enabled (see CMakeLists.txt), the
+// kernels are only used if _getCPUFeatures() reports AVX2 support at runtime
+#ifdef __AVX2__
+#define TH_AVX2
+#include <immintrin.h>
+#include "TheoraConversionSSE2.h"
+
+namespace
+{
+	/**
+		32 bit chroma terms for 32 pixels. AVX2 unpacks work within 128 bit lanes, so
+		entry i holds pixels [4i,4i+4) in the low lane and [16+4i,20+4i) in the high lane
+	*/
+	struct ChromaTerms
+	{
+		__m256i r[4],g[4],b[4];
+	};
+
+	inline void _chromaTerms(const unsigned char* uSrc,const unsigned char* vSrc,ChromaTerms& t)
+	{
+		const __m256i c128=_mm256_set1_epi16(128),
+		              cr=_mm256_set1_epi32(TH_YUV_RV),
+		              cg=_mm256_set1_epi32((TH_YUV_GU << 16) | TH_YUV_GV),
+		              cb=_mm256_set1_epi32(TH_YUV_BU << 16);
+
+		__m256i u=_mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) uSrc)),c128),
+		        v=_mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) vSrc)),c128);
+		__m256i vu[2]={_mm256_unpacklo_epi16(v,u),_mm256_unpackhi_epi16(v,u)};
+		for (int i=0;i<2;i++)
+		{
+			__m256i r=_mm256_madd_epi16(vu[i],cr),g=_mm256_madd_epi16(vu[i],cg),b=_mm256_madd_epi16(vu[i],cb);
+			t.r[i*2]=_mm256_unpacklo_epi32(r,r); t.r[i*2+1]=_mm256_unpackhi_epi32(r,r);
+			t.g[i*2]=_mm256_unpacklo_epi32(g,g); t.g[i*2+1]=_mm256_unpackhi_epi32(g,g);
+			t.b[i*2]=_mm256_unpacklo_epi32(b,b); t.b[i*2+1]=_mm256_unpackhi_epi32(b,b);
+		}
+	}
+
+	//! converts 32 luma samples of a row into saturated 8 bit R,G,B vectors (in pixel order)
+	inline void _convertRow(const unsigned char* ySrc,const ChromaTerms& t,__m256i& r,__m256i& g,__m256i& b)
+	{
+		const __m256i zero=_mm256_setzero_si256(),c16=_mm256_set1_epi16(16),cy=_mm256_set1_epi32(TH_YUV_Y);
+		__m256i y8=_mm256_loadu_si256((const __m256i*) ySrc);
+		__m256i y16[2]={_mm256_sub_epi16(_mm256_unpacklo_epi8(y8,zero),c16),_mm256_sub_epi16(_mm256_unpackhi_epi8(y8,zero),c16)};
+		__m256i yt,rr[4],gg[4],bb[4];
+		for (int i=0;i<4;i++)
+		{
+			yt=_mm256_madd_epi16((i & 1) ? _mm256_unpackhi_epi16(y16[i/2],zero) : _mm256_unpacklo_epi16(y16[i/2],zero),cy);
+			rr[i]=_mm256_srai_epi32(_mm256_add_epi32(yt,t.r[i]),13);
+			gg[i]=_mm256_srai_epi32(_mm256_sub_epi32(yt,t.g[i]),13);
+			bb[i]=_mm256_srai_epi32(_mm256_add_epi32(yt,t.b[i]),13);
+		}
+		// the in-lane packs undo the in-lane unpacks, so the result is in pixel order again
+		r=_mm256_packus_epi16(_mm256_packs_epi32(rr[0],rr[1]),_mm256_packs_epi32(rr[2],rr[3]));
+		g=_mm256_packus_epi16(_mm256_packs_epi32(gg[0],gg[1]),_mm256_packs_epi32(gg[2],gg[3]));
+		b=_mm256_packus_epi16(_mm256_packs_epi32(bb[0],bb[1]),_mm256_packs_epi32(bb[2],bb[3]));
+	}
+
+	template <int mode> inline void _storePixels32(unsigned char* out,__m256i r,__m256i g,__m256i b)
+	{
+		_storePixels<mode>(out,_mm256_castsi256_si128(r),_mm256_castsi256_si128(g),_mm256_castsi256_si128(b));
+		_storePixels<mode>(out+16*_bytesPerPixel<mode>(),_mm256_extracti128_si256(r,1),
+		                   _mm256_extracti128_si256(g,1),_mm256_extracti128_si256(b,1));
+	}
+
+	template <int mode> void _decodeRGB_AVX2(th_img_plane* yuv,unsigned char* out,int stride)
+	{
+		const int nBytes=_bytesPerPixel<mode>(),pitch=stride*nBytes,w=yuv[0].width & ~31;
+		ChromaTerms t;
+		__m256i r,g,b;
+		for (int y=0;y<yuv[0].height;y+=2)
+		{
+			unsigned char *ySrc=yuv[0].data+y*yuv[0].stride,
+			              *uSrc=yuv[1].data+(y/2)*yuv[1].stride,
+			              *vSrc=yuv[2].data+(y/2)*yuv[2].stride,
+			              *row=out+y*pitch;
+			for (int x=0;x<w;x+=32)
+			{
+				_chromaTerms(uSrc+x/2,vSrc+x/2,t);
+				_convertRow(ySrc+x,t,r,g,b);
+				_storePixels32<mode>(row+x*nBytes,r,g,b);
+				_convertRow(ySrc+yuv[0].stride+x,t,r,g,b);
+				_storePixels32<mode>(row+pitch+x*nBytes,r,g,b);
+			}
+		}
+		_convertTail((TheoraOutputMode) mode,yuv,out,stride,w);
+	}
+}
+#endif
+
+bool _getAVX2ConversionFunctions(TheoraConversionFunction* table)
+{
+#ifdef TH_AVX2
+	// grey and yuv modes are bound by stores, the SSE2 kernels are used for those
+	table[TH_RGB] =_decodeRGB_AVX2<TH_RGB>;
+	table[TH_RGBA]=_decodeRGB_AVX2<TH_RGBA>;
+	table[TH_ARGB]=_decodeRGB_AVX2<TH_ARGB>;
+	table[TH_BGR] =_decodeRGB_AVX2<TH_BGR>;
+	table[TH_BGRA]=_decodeRGB_AVX2<TH_BGRA>;
+	table[TH_ABGR]=_decodeRGB_AVX2<TH_ABGR>;
+	return true;
+#else
+	(void) table;
+	return false;
+#endif
+}
@@ -0,0 +1,206 @@
+/************************************************************************************
+This source file is part of the Theora Video Playback Library
+For latest info, see http://libtheoraplayer.sourceforge.net/
+*************************************************************************************
+Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
+This program is free software; you can redistribute it and/or modify it under
+the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
+*************************************************************************************/
+#include <string.h>
+#include "TheoraConversion.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define TH_NEON
+#include <arm_neon.h>
+
+namespace
+{
+	//! 32 bit chroma terms for 16 pixels, each of the 8 chroma samples is used twice
+	struct ChromaTerms
+	{
+		int32x4_t r[4],g[4],b[4];
+	};
+
+	inline void _chromaTerms(const unsigned char* uSrc,const unsigned char* vSrc,ChromaTerms& t)
+	{
+		int16x8_t u=vreinterpretq_s16_u16(vsubl_u8(vld1_u8(uSrc),vdup_n_u8(128))),
+		          v=vreinterpretq_s16_u16(vsubl_u8(vld1_u8(vSrc),vdup_n_u8(128)));
+		for (int i=0;i<2;i++)
+		{
+			int16x4_t uh=i ? vget_high_s16(u) : vget_low_s16(u),
+			          vh=i ? vget_high_s16(v) : vget_low_s16(v);
+			int32x4x2_t r=vzipq_s32(vmull_n_s16(vh,TH_YUV_RV),vmull_n_s16(vh,TH_YUV_RV)),
+			            g=vzipq_s32(vmlal_n_s16(vmull_n_s16(uh,TH_YUV_GU),vh,TH_YUV_GV),
+			                        vmlal_n_s16(vmull_n_s16(uh,TH_YUV_GU),vh,TH_YUV_GV)),
+			            b=vzipq_s32(vmull_n_s16(uh,TH_YUV_BU),vmull_n_s16(uh,TH_YUV_BU));
+			t.r[i*2]=r.val[0]; t.r[i*2+1]=r.val[1];
+			t.g[i*2]=g.val[0]; t.g[i*2+1]=g.val[1];
+			t.b[i*2]=b.val[0]; t.b[i*2+1]=b.val[1];
+		}
+	}
+
+	//! saturates 16 32 bit values into 16 bytes
+	inline uint8x16_t _narrow(const int32x4_t* c)
+	{
+		return vcombine_u8(vqmovun_s16(vcombine_s16(vqmovn_s32(c[0]),vqmovn_s32(c[1]))),
+		                   vqmovun_s16(vcombine_s16(vqmovn_s32(c[2]),vqmovn_s32(c[3]))));
+	}
+
+	//! converts 16 luma samples of a row into saturated 8 bit R,G,B vectors
+	inline void _convertRow(const unsigned char* ySrc,const ChromaTerms& t,uint8x16_t& r,uint8x16_t& g,uint8x16_t& b)
+	{
+		uint8x16_t y8=vld1q_u8(ySrc);
+		int16x8_t y16[2]={vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(y8),vdup_n_u8(16))),
+		                  vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(y8),vdup_n_u8(16)))};
+		int32x4_t yt,rr[4],gg[4],bb[4];
+		for (int i=0;i<4;i++)
+		{
+			yt=vmull_n_s16((i & 1) ? vget_high_s16(y16[i/2]) : vget_low_s16(y16[i/2]),TH_YUV_Y);
+			rr[i]=vshrq_n_s32(vaddq_s32(yt,t.r[i]),13);
+			gg[i]=vshrq_n_s32(vsubq_s32(yt,t.g[i]),13);
+			bb[i]=vshrq_n_s32(vaddq_s32(yt,t.b[i]),13);
+		}
+		r=_narrow(rr); g=_narrow(gg); b=_narrow(bb);
+	}
+
+	template <int mode> inline int _bytesPerPixel()
+	{
+		return (mode == TH_RGB || mode == TH_BGR || mode == TH_GREY3 || mode == TH_YUV) ? 3 : 4;
+	}
+
+	//! writes 16 pixels made of components a,b,c (RGB or YUV order) in the mode's byte order
+	template <int mode> inline void _storePixels(unsigned char* out,uint8x16_t a,uint8x16_t b,uint8x16_t c)
+	{
+		uint8x16_t ff=vdupq_n_u8(255);
+		uint8x16x3_t p3;
+		uint8x16x4_t p4;
+		switch (mode)
+		{
+		case TH_RGB:  case TH_GREY3:  case TH_YUV:
+			p3.val[0]=a; p3.val[1]=b; p3.val[2]=c; vst3q_u8(out,p3); break;
+		case TH_RGBA: case TH_GREY3A: case TH_YUVA:
+			p4.val[0]=a; p4.val[1]=b; p4.val[2]=c; p4.val[3]=ff; vst4q_u8(out,p4); break;
+		case TH_ARGB: case TH_AGREY3: case TH_AYUV:
+			p4.val[0]=ff; p4.val[1]=a; p4.val[2]=b; p4.val[3]=c; vst4q_u8(out,p4); break;
+		case TH_BGR:
+			p3.val[0]=c; p3.val[1]=b; p3.val[2]=a; vst3q_u8(out,p3); break;
+		case TH_BGRA:
+			p4.val[0]=c; p4.val[1]=b; p4.val[2]=a; p4.val[3]=ff; vst4q_u8(out,p4); break;
+		case TH_ABGR:
+			p4.val[0]=ff; p4.val[1]=c; p4.val[2]=b; p4.val[3]=a; vst4q_u8(out,p4); break;
+		}
+	}
+
+	template <int mode> void _decodeRGB_NEON(th_img_plane* yuv,unsigned char* out,int stride)
+	{
+		const int nBytes=_bytesPerPixel<mode>(),pitch=stride*nBytes,w=yuv[0].width & ~15;
+		ChromaTerms t;
+		uint8x16_t r,g,b;
+		for (int y=0;y<yuv[0].height;y+=2)
+		{
+			unsigned char *ySrc=yuv[0].data+y*yuv[0].stride,
+			              *uSrc=yuv[1].data+(y/2)*yuv[1].stride,
+			              *vSrc=yuv[2].data+(y/2)*yuv[2].stride,
+			              *row=out+y*pitch;
+			for (int x=0;x<w;x+=16)
+			{
+				_chromaTerms(uSrc+x/2,vSrc+x/2,t);
+				_convertRow(ySrc+x,t,r,g,b);
+				_storePixels<mode>(row+x*nBytes,r,g,b);
+				_convertRow(ySrc+yuv[0].stride+x,t,r,g,b);
+				_storePixels<mode>(row+pitch+x*nBytes,r,g,b);
+			}
+		}
+		_convertTail((TheoraOutputMode) mode,yuv,out,stride,w);
+	}
+
+	template <int mode> void _decodeGrey3_NEON(th_img_plane* yuv,unsigned char* out,int stride)
+	{
+		const int nBytes=_bytesPerPixel<mode>(),pitch=stride*nBytes,w=yuv[0].width & ~15;
+		for (int y=0;y<yuv[0].height;y++)
+		{
+			unsigned char *ySrc=yuv[0].data+y*yuv[0].stride,*row=out+y*pitch;
+			for (int x=0;x<w;x+=16)
+			{
+				uint8x16_t l=vld1q_u8(ySrc+x);
+				_storePixels<mode>(row+x*nBytes,l,l,l);
+			}
+		}
+		_convertTail((TheoraOutputMode) mode,yuv,out,stride,w);
+	}
+
+	template <int mode> void _decodeYUV_NEON(th_img_plane* yuv,unsigned char* out,int stride)
+	{
+		const int nBytes=_bytesPerPixel<mode>(),pitch=stride*nBytes,w=yuv[0].width & ~15;
+		for (int y=0;y<yuv[0].height;y+=2)
+		{
+			unsigned char *ySrc=yuv[0].data+y*yuv[0].stride,
+			              *uSrc=yuv[1].data+(y/2)*yuv[1].stride,
+			              *vSrc=yuv[2].data+(y/2)*yuv[2].stride,
+			              *row=out+y*pitch;
+			for (int x=0;x<w;x+=16)
+			{
+				uint8x8_t u=vld1_u8(uSrc+x/2),v=vld1_u8(vSrc+x/2);
+				uint8x8x2_t ud=vzip_u8(u,u),vd=vzip_u8(v,v);
+				uint8x16_t u16=vcombine_u8(ud.val[0],ud.val[1]),v16=vcombine_u8(vd.val[0],vd.val[1]);
+				_storePixels<mode>(row+x*nBytes,vld1q_u8(ySrc+x),u16,v16);
+				_storePixels<mode>(row+pitch+x*nBytes,vld1q_u8(ySrc+yuv[0].stride+x),u16,v16);
+			}
+		}
+		_convertTail((TheoraOutputMode) mode,yuv,out,stride,w);
+	}
+
+	void _decodeGrey_NEON(th_img_plane* yuv,unsigned char* out,int stride)
+	{
+		for (int y=0;y<yuv[0].height;y++)
+			memcpy(out+y*stride,yuv[0].data+y*yuv[0].stride,yuv[0].width);
+	}
+
+	void _decodeNV12_NEON(th_img_plane* yuv,unsigned char* out,int stride)
+	{
+		const int w=yuv[1].width & ~15;
+		unsigned char *uSrc=yuv[1].data,*vSrc=yuv[2].data,*uv=out+stride*yuv[0].height;
+		int x;
+		uint8x16x2_t p;
+		_copyPlane(&yuv[0],out,stride);
+		for (int y=0;y<yuv[1].height;y++,uSrc+=yuv[1].stride,vSrc+=yuv[2].stride,uv+=stride)
+		{
+			for (x=0;x<w;x+=16)
+			{
+				p.val[0]=vld1q_u8(uSrc+x);
+				p.val[1]=vld1q_u8(vSrc+x);
+				vst2q_u8(uv+x*2,p);
+			}
+			for (;x<yuv[1].width;x++)
+			{
+				uv[x*2]  =uSrc[x];
+				uv[x*2+1]=vSrc[x];
+			}
+		}
+	}
+}
+#endif
+
+bool _getNEONConversionFunctions(TheoraConversionFunction* table)
+{
+#ifdef TH_NEON
+	table[TH_RGB]   =_decodeRGB_NEON<TH_RGB>;
+	table[TH_RGBA]  =_decodeRGB_NEON<TH_RGBA>;
+	table[TH_ARGB]  =_decodeRGB_NEON<TH_ARGB>;
+	table[TH_BGR]   =_decodeRGB_NEON<TH_BGR>;
+	table[TH_BGRA]  =_decodeRGB_NEON<TH_BGRA>;
+	table[TH_ABGR]  =_decodeRGB_NEON<TH_ABGR>;
+	table[TH_GREY]  =_decodeGrey_NEON;
+	table[TH_GREY3] =_decodeGrey3_NEON<TH_GREY3>;
+	table[TH_GREY3A]=_decodeGrey3_NEON<TH_GREY3A>;
+	table[TH_AGREY3]=_decodeGrey3_NEON<TH_AGREY3>;
+	table[TH_YUV]   =_decodeYUV_NEON<TH_YUV>;
+	table[TH_YUVA]  =_decodeYUV_NEON<TH_YUVA>;
+	table[TH_AYUV]  =_decodeYUV_NEON<TH_AYUV>;
+	table[TH_NV12]  =_decodeNV12_NEON;
+	return true;
+#else
+	(void) table;
+	return false;
+#endif
+}
@@ -0,0 +1,172 @@
+/************************************************************************************
+This source file is part of the Theora Video Playback Library
+For latest info, see http://libtheoraplayer.sourceforge.net/
+*************************************************************************************
+Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
+This program is free software; you can redistribute it and/or modify it under
+the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
+*************************************************************************************/
+#include "TheoraConversion.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TH_SSE2
+#include "TheoraConversionSSE2.h"
+
+namespace
+{
+	//! 32 bit chroma terms for 16 pixels, each of the 8 chroma samples is used twice
+	struct ChromaTerms
+	{
+		__m128i r[4],g[4],b[4];
+	};
+
+	inline void _chromaTerms(const unsigned char* uSrc,const unsigned char* vSrc,ChromaTerms& t)
+	{
+		const __m128i zero=_mm_setzero_si128(),c128=_mm_set1_epi16(128),
+		              cr=_mm_setr_epi16(TH_YUV_RV,0,TH_YUV_RV,0,TH_YUV_RV,0,TH_YUV_RV,0),
+		              cg=_mm_setr_epi16(TH_YUV_GV,TH_YUV_GU,TH_YUV_GV,TH_YUV_GU,TH_YUV_GV,TH_YUV_GU,TH_YUV_GV,TH_YUV_GU),
+		              cb=_mm_setr_epi16(0,TH_YUV_BU,0,TH_YUV_BU,0,TH_YUV_BU,0,TH_YUV_BU);
+
+		__m128i u=_mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) uSrc),zero),c128),
+		        v=_mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) vSrc),zero),c128);
+		// (v,u) pairs so a single madd evaluates a whole chroma term
+		__m128i vu[2]={_mm_unpacklo_epi16(v,u),_mm_unpackhi_epi16(v,u)};
+		for (int i=0;i<2;i++)
+		{
+			__m128i r=_mm_madd_epi16(vu[i],cr),g=_mm_madd_epi16(vu[i],cg),b=_mm_madd_epi16(vu[i],cb);
+			t.r[i*2]=_mm_unpacklo_epi32(r,r); t.r[i*2+1]=_mm_unpackhi_epi32(r,r);
+			t.g[i*2]=_mm_unpacklo_epi32(g,g); t.g[i*2+1]=_mm_unpackhi_epi32(g,g);
+			t.b[i*2]=_mm_unpacklo_epi32(b,b); t.b[i*2+1]=_mm_unpackhi_epi32(b,b);
+		}
+	}
+
+	//! converts 16 luma samples of a row into saturated 8 bit R,G,B vectors
+	inline void _convertRow(const unsigned char* ySrc,const ChromaTerms& t,__m128i& r,__m128i& g,__m128i& b)
+	{
+		const __m128i zero=_mm_setzero_si128(),c16=_mm_set1_epi16(16),cy=_mm_set1_epi32(TH_YUV_Y);
+		__m128i y8=_mm_loadu_si128((const __m128i*) ySrc);
+		__m128i y16[2]={_mm_sub_epi16(_mm_unpacklo_epi8(y8,zero),c16),_mm_sub_epi16(_mm_unpackhi_epi8(y8,zero),c16)};
+		__m128i yt,rr[4],gg[4],bb[4];
+		for (int i=0;i<4;i++)
+		{
+			yt=_mm_madd_epi16((i & 1) ? _mm_unpackhi_epi16(y16[i/2],zero) : _mm_unpacklo_epi16(y16[i/2],zero),cy);
+			rr[i]=_mm_srai_epi32(_mm_add_epi32(yt,t.r[i]),13);
+			gg[i]=_mm_srai_epi32(_mm_sub_epi32(yt,t.g[i]),13);
+			bb[i]=_mm_srai_epi32(_mm_add_epi32(yt,t.b[i]),13);
+		}
+		r=_mm_packus_epi16(_mm_packs_epi32(rr[0],rr[1]),_mm_packs_epi32(rr[2],rr[3]));
+		g=_mm_packus_epi16(_mm_packs_epi32(gg[0],gg[1]),_mm_packs_epi32(gg[2],gg[3]));
+		b=_mm_packus_epi16(_mm_packs_epi32(bb[0],bb[1]),_mm_packs_epi32(bb[2],bb[3]));
+	}
+
+	template <int mode> void _decodeRGB_SSE2(th_img_plane* yuv,unsigned char* out,int stride)
+	{
+		const int nBytes=_bytesPerPixel<mode>(),pitch=stride*nBytes,w=yuv[0].width & ~15;
+		ChromaTerms t;
+		__m128i r,g,b;
+		for (int y=0;y<yuv[0].height;y+=2)
+		{
+			unsigned char *ySrc=yuv[0].data+y*yuv[0].stride,
+			              *uSrc=yuv[1].data+(y/2)*yuv[1].stride,
+			              *vSrc=yuv[2].data+(y/2)*yuv[2].stride,
+			              *row=out+y*pitch;
+			for (int x=0;x<w;x+=16)
+			{
+				_chromaTerms(uSrc+x/2,vSrc+x/2,t);
+				_convertRow(ySrc+x,t,r,g,b);
+				_storePixels<mode>(row+x*nBytes,r,g,b);
+				_convertRow(ySrc+yuv[0].stride+x,t,r,g,b);
+				_storePixels<mode>(row+pitch+x*nBytes,r,g,b);
+			}
+		}
+		_convertTail((TheoraOutputMode) mode,yuv,out,stride,w);
+	}
+
+	template <int mode> void _decodeGrey3_SSE2(th_img_plane* yuv,unsigned char* out,int stride)
+	{
+		const int nBytes=_bytesPerPixel<mode>(),pitch=stride*nBytes,w=yuv[0].width & ~15;
+		for (int y=0;y<yuv[0].height;y++)
+		{
+			unsigned char *ySrc=yuv[0].data+y*yuv[0].stride,*row=out+y*pitch;
+			for (int x=0;x<w;x+=16)
+			{
+				__m128i l=_mm_loadu_si128((const __m128i*) (ySrc+x));
+				_storePixels<mode>(row+x*nBytes,l,l,l);
+			}
+		}
+		_convertTail((TheoraOutputMode) mode,yuv,out,stride,w);
+	}
+
+	template <int mode> void _decodeYUV_SSE2(th_img_plane* yuv,unsigned char* out,int stride)
+	{
+		const int nBytes=_bytesPerPixel<mode>(),pitch=stride*nBytes,w=yuv[0].width & ~15;
+		for (int y=0;y<yuv[0].height;y+=2)
+		{
+			unsigned char *ySrc=yuv[0].data+y*yuv[0].stride,
+			              *uSrc=yuv[1].data+(y/2)*yuv[1].stride,
+			              *vSrc=yuv[2].data+(y/2)*yuv[2].stride,
+			              *row=out+y*pitch;
+			for (int x=0;x<w;x+=16)
+			{
+				__m128i u=_mm_loadl_epi64((const __m128i*) (uSrc+x/2)),v=_mm_loadl_epi64((const __m128i*) (vSrc+x/2));
+				u=_mm_unpacklo_epi8(u,u); v=_mm_unpacklo_epi8(v,v);
+				_storePixels<mode>(row+x*nBytes,_mm_loadu_si128((const __m128i*) (ySrc+x)),u,v);
+				_storePixels<mode>(row+pitch+x*nBytes,_mm_loadu_si128((const __m128i*) (ySrc+yuv[0].stride+x)),u,v);
+			}
+		}
+		_convertTail((TheoraOutputMode) mode,yuv,out,stride,w);
+	}
+
+	void _decodeGrey_SSE2(th_img_plane* yuv,unsigned char* out,int stride)
+	{
+		for (int y=0;y<yuv[0].height;y++)
+			memcpy(out+y*stride,yuv[0].data+y*yuv[0].stride,yuv[0].width);
+	}
+
+	void _decodeNV12_SSE2(th_img_plane* yuv,unsigned char* out,int stride)
+	{
+		const int w=yuv[1].width & ~15;
+		unsigned char *uSrc=yuv[1].data,*vSrc=yuv[2].data,*uv=out+stride*yuv[0].height;
+		int x;
+		_copyPlane(&yuv[0],out,stride);
+		for (int y=0;y<yuv[1].height;y++,uSrc+=yuv[1].stride,vSrc+=yuv[2].stride,uv+=stride)
+		{
+			for (x=0;x<w;x+=16)
+			{
+				__m128i u=_mm_loadu_si128((const __m128i*) (uSrc+x)),v=_mm_loadu_si128((const __m128i*) (vSrc+x));
+				_mm_storeu_si128((__m128i*) (uv+x*2),   _mm_unpacklo_epi8(u,v));
+				_mm_storeu_si128((__m128i*) (uv+x*2+16),_mm_unpackhi_epi8(u,v));
+			}
+			for (;x<yuv[1].width;x++)
+			{
+				uv[x*2]  =uSrc[x];
+				uv[x*2+1]=vSrc[x];
+			}
+		}
+	}
+}
+#endif
+
+bool _getSSE2ConversionFunctions(TheoraConversionFunction* table)
+{
+#ifdef TH_SSE2
+	table[TH_RGB]   =_decodeRGB_SSE2<TH_RGB>;
+	table[TH_RGBA]  =_decodeRGB_SSE2<TH_RGBA>;
+	table[TH_ARGB]  =_decodeRGB_SSE2<TH_ARGB>;
+	table[TH_BGR]   =_decodeRGB_SSE2<TH_BGR>;
+	table[TH_BGRA]  =_decodeRGB_SSE2<TH_BGRA>;
+	table[TH_ABGR]  =_decodeRGB_SSE2<TH_ABGR>;
+	table[TH_GREY]  =_decodeGrey_SSE2;
+	table[TH_GREY3] =_decodeGrey3_SSE2<TH_GREY3>;
+	table[TH_GREY3A]=_decodeGrey3_SSE2<TH_GREY3A>;
+	table[TH_AGREY3]=_decodeGrey3_SSE2<TH_AGREY3>;
+	table[TH_YUV]   =_decodeYUV_SSE2<TH_YUV>;
+	table[TH_YUVA]  =_decodeYUV_SSE2<TH_YUVA>;
+	table[TH_AYUV]  =_decodeYUV_SSE2<TH_AYUV>;
+	table[TH_NV12]  =_decodeNV12_SSE2;
+	return true;
+#else
+	(void) table;
+	return false;
+#endif
+}
@@ -0,0 +1,78 @@
+/************************************************************************************
+This source file is part of the Theora Video Playback Library
+For latest info, see http://libtheoraplayer.sourceforge.net/
+*************************************************************************************
+Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
+This program is free software; you can redistribute it and/or modify it under
+the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
+*************************************************************************************/
+#ifndef _TheoraConversionSSE2_h
+#define _TheoraConversionSSE2_h
+
+#include <string.h>
+#include <emmintrin.h>
+#include "TheoraConversion.h"
+
+// Pixel store helpers shared by the SSE2 and AVX2 kernels. Everything here has internal
+// linkage on purpose: the AVX2 translation unit is compiled with different code generation
+// flags and its instantiations must never be merged with the SSE2 ones by the linker.
+namespace
+{
+	//! interleaves four vectors of 16 components into 16 4-byte pixels
+	inline void _store4(unsigned char* out,__m128i c0,__m128i c1,__m128i c2,__m128i c3)
+	{
+		__m128i t0=_mm_unpacklo_epi8(c0,c1),t1=_mm_unpackhi_epi8(c0,c1),
+		        t2=_mm_unpacklo_epi8(c2,c3),t3=_mm_unpackhi_epi8(c2,c3);
+		_mm_storeu_si128((__m128i*) out,     _mm_unpacklo_epi16(t0,t2));
+		_mm_storeu_si128((__m128i*) (out+16),_mm_unpackhi_epi16(t0,t2));
+		_mm_storeu_si128((__m128i*) (out+32),_mm_unpacklo_epi16(t1,t3));
+		_mm_storeu_si128((__m128i*) (out+48),_mm_unpackhi_epi16(t1,t3));
+	}
+
+	//! interleaves three vectors of 16 components into 16 3-byte pixels
+	inline void _store3(unsigned char* out,__m128i c0,__m128i c1,__m128i c2)
+	{
+		const __m128i lo=_mm_set_epi32(0,0xFFFFFF,0,0xFFFFFF),hi=_mm_set_epi32(0xFFFF,(int) 0xFF000000,0xFFFF,(int) 0xFF000000);
+		__m128i t0=_mm_unpacklo_epi8(c0,c1),t1=_mm_unpackhi_epi8(c0,c1),
+		        t2=_mm_unpacklo_epi8(c2,c2),t3=_mm_unpackhi_epi8(c2,c2),p[4];
+		p[0]=_mm_unpacklo_epi16(t0,t2); p[1]=_mm_unpackhi_epi16(t0,t2);
+		p[2]=_mm_unpacklo_epi16(t1,t3); p[3]=_mm_unpackhi_epi16(t1,t3);
+		unsigned char last[8];
+		for (int i=0;i<4;i++)
+		{
+			// squeeze the two 4 byte pixels of each 64 bit lane into its low 6 bytes
+			__m128i q=_mm_or_si128(_mm_and_si128(p[i],lo),_mm_and_si128(_mm_srli_epi64(p[i],8),hi));
+			// overlapping 8 byte stores, each one overwrites the 2 garbage bytes of the previous one
+			_mm_storel_epi64((__m128i*) (out+i*12),q);
+			if (i < 3) _mm_storel_epi64((__m128i*) (out+i*12+6),_mm_srli_si128(q,8));
+			else
+			{
+				// don't write past the last pixel
+				_mm_storel_epi64((__m128i*) last,_mm_srli_si128(q,8));
+				memcpy(out+42,last,6);
+			}
+		}
+	}
+
+	//! writes 16 pixels made of components a,b,c (RGB or YUV order) in the mode's byte order
+	template <int mode> inline void _storePixels(unsigned char* out,__m128i a,__m128i b,__m128i c)
+	{
+		const __m128i ff=_mm_set1_epi8(-1);
+		switch (mode)
+		{
+		case TH_RGB:  case TH_GREY3:  case TH_YUV:  _store3(out,a,b,c);    break;
+		case TH_RGBA: case TH_GREY3A: case TH_YUVA: _store4(out,a,b,c,ff); break;
+		case TH_ARGB: case TH_AGREY3: case TH_AYUV: _store4(out,ff,a,b,c); break;
+		case TH_BGR:  _store3(out,c,b,a);    break;
+		case TH_BGRA: _store4(out,c,b,a,ff); break;
+		case TH_ABGR: _store4(out,ff,c,b,a); break;
+		}
+	}
+
+	template <int mode> inline int _bytesPerPixel()
+	{
+		return (mode == TH_RGB || mode == TH_BGR || mode == TH_GREY3 || mode == TH_YUV) ? 3 : 4;
+	}
+}
+
+#endif
@@ -9,19 +9,41 @@ the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
 #define _CRT_SECURE_NO_WARNINGS // MSVC++
 #include <stdio.h>
 #include <memory.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include "TheoraDataSource.h"
 #include "TheoraException.h"
+#include "TheoraAsync.h"
+#include "TheoraUtil.h"
+
+//! number of bytes after the read pointer the OS is asked to load after a seek
+#define TH_MMAP_PREFETCH_SIZE 262144
+//! largest read the read-ahead I/O thread issues at once
+#define TH_READ_AHEAD_CHUNK_SIZE 65536
 
 TheoraDataSource::~TheoraDataSource()
 {
 
 }
 
-TheoraFileDataSource::TheoraFileDataSource(std::string filename)
+TheoraFileDataSource::TheoraFileDataSource(std::string filename,bool deferOpen)
 {
 	mFilename=filename;
-	mFilePtr=fopen(filename.c_str(),"rb");
-	if (!mFilePtr) throw TheoraGenericException("Can't open video file: "+filename);
+	mFilePtr=NULL;
+	mSize=0;
+	if (!deferOpen) open();
+}
+
+void TheoraFileDataSource::open()
+{
+	mFilePtr=fopen(mFilename.c_str(),"rb");
+	if (!mFilePtr) throw TheoraGenericException("Can't open video file: "+mFilename);
 	fseek(mFilePtr,0,SEEK_END);
 	mSize=ftell(mFilePtr);
 	fseek(mFilePtr,0,SEEK_SET);
@@ -34,22 +56,26 @@ TheoraFileDataSource::~TheoraFileDataSource()
 
 int TheoraFileDataSource::read(void* output,int nBytes)
 {
+	if (!mFilePtr) open();
 	int n=fread(output,1,nBytes,mFilePtr);
 	return n;
 }
 
 void TheoraFileDataSource::seek(unsigned long byte_index)
 {
+	if (!mFilePtr) open();
 	fseek(mFilePtr,byte_index,SEEK_SET);
 }
 
 unsigned long TheoraFileDataSource::size()
 {
+	if (!mFilePtr) open();
 	return mSize;
 }
 
 unsigned long TheoraFileDataSource::tell()
 {
+	if (!mFilePtr) open();
 	return ftell(mFilePtr);
 }
 
@@ -96,3 +122,319 @@ unsigned long TheoraMemoryFileDataSource::tell()
 {
 	return mReadPointer;
 }
+
+TheoraMmapDataSource::TheoraMmapDataSource(std::string filename) :
+	mSize(0),
+	mReadPointer(0),
+	mData(0)
+{
+	mFilename=filename;
+#ifdef _WIN32
+	mMapping=NULL;
+	mFile=CreateFileA(filename.c_str(),GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_FLAG_SEQUENTIAL_SCAN,NULL);
+	if (mFile == INVALID_HANDLE_VALUE) throw TheoraGenericException("Can't open video file: "+filename);
+	mSize=GetFileSize(mFile,NULL);
+	if (mSize > 0)
+	{
+		mMapping=CreateFileMappingA(mFile,NULL,PAGE_READONLY,0,0,NULL);
+		if (mMapping) mData=(unsigned char*) MapViewOfFile(mMapping,FILE_MAP_READ,0,0,0);
+		if (!mData)
+		{
+			if (mMapping) CloseHandle(mMapping);
+			CloseHandle(mFile);
+			throw TheoraGenericException("Can't map video file: "+filename);
+		}
+	}
+#else
+	mFile=open(filename.c_str(),O_RDONLY);
+	if (mFile < 0) throw TheoraGenericException("Can't open video file: "+filename);
+	struct stat st;
+	if (fstat(mFile,&st) == 0) mSize=st.st_size;
+	if (mSize > 0)
+	{
+		void* data=mmap(NULL,mSize,PROT_READ,MAP_SHARED,mFile,0);
+		if (data == MAP_FAILED)
+		{
+			close(mFile);
+			throw TheoraGenericException("Can't map video file: "+filename);
+		}
+		mData=(unsigned char*) data;
+		// playback reads the file front to back, let the kernel read ahead aggressively
+		madvise(mData,mSize,MADV_SEQUENTIAL);
+	}
+#endif
+}
+
+TheoraMmapDataSource::~TheoraMmapDataSource()
+{
+#ifdef _WIN32
+	if (mData) UnmapViewOfFile(mData);
+	if (mMapping) CloseHandle(mMapping);
+	CloseHandle(mFile);
+#else
+	if (mData) munmap(mData,mSize);
+	close(mFile);
+#endif
+}
+
+int TheoraMmapDataSource::read(void* output,int nBytes)
+{
+	int n=(mReadPointer+nBytes <= mSize) ? nBytes : mSize-mReadPointer;
+	if (!n) return 0;
+	memcpy(output,mData+mReadPointer,n);
+	mReadPointer+=n;
+	return n;
+}
+
+void TheoraMmapDataSource::prefetch()
+{
+#ifndef _WIN32
+	// madvise needs a page aligned address
+	unsigned long page=sysconf(_SC_PAGESIZE),start=mReadPointer-mReadPointer%page,
+	              end=(mReadPointer+TH_MMAP_PREFETCH_SIZE < mSize) ? mReadPointer+TH_MMAP_PREFETCH_SIZE : mSize;
+	madvise(mData+start,end-start,MADV_WILLNEED);
+#endif
+}
+
+void TheoraMmapDataSource::seek(unsigned long byte_index)
+{
+	bool jump=byte_index != mReadPointer;
+	mReadPointer=(byte_index < mSize) ? byte_index : mSize;
+	// sequential read ahead doesn't help with random access, so fetch the new position's
+	// pages right away instead of faulting them in one by one
+	if (jump && mReadPointer < mSize) prefetch();
+}
+
+unsigned long TheoraMmapDataSource::size()
+{
+	return mSize;
+}
+
+unsigned long TheoraMmapDataSource::tell()
+{
+	return mReadPointer;
+}
+
+/**
+	Fills the window of a TheoraReadAheadDataSource, sleeps while the window is full
+*/
+class TheoraReadAheadThread : public TheoraThread
+{
+	TheoraReadAheadDataSource* mDataSource;
+public:
+	TheoraReadAheadThread(TheoraReadAheadDataSource* data_source)
+	{
+		mDataSource=data_source;
+	}
+
+	void executeThread()
+	{
+		while (mThreadRunning)
+		{
+			unsigned int events=mDataSource->mSpaceEvent->getCount();
+			if (!mThreadRunning) break;
+			if (!mDataSource->_fill()) mDataSource->mSpaceEvent->wait(events);
+		}
+	}
+};
+
+TheoraReadAheadDataSource::TheoraReadAheadDataSource(TheoraDataSource* source,unsigned long window_size) :
+	mHead(0),
+	mWindowStart(0),
+	mFilled(0),
+	mReadPointer(0),
+	mMissEnd(0),
+	mGeneration(0),
+	mNumHits(0),
+	mNumMisses(0),
+	mStallTime(0)
+{
+	mSource=source;
+	mSize=source->size();
+	mWindowSize=(window_size > 4096) ? window_size : 4096;
+	// a read has to fit into a quarter of the window so the I/O thread doesn't wait for the reader
+	mChunkSize=(mWindowSize/4 < TH_READ_AHEAD_CHUNK_SIZE) ? mWindowSize/4 : TH_READ_AHEAD_CHUNK_SIZE;
+	mBuffer=new unsigned char[mWindowSize];
+	mChunk=new unsigned char[mChunkSize];
+	mSource->seek(0);
+
+	mMutex=new TheoraMutex;
+	mSourceMutex=new TheoraMutex;
+	mDataEvent=new TheoraEvent;
+	mSpaceEvent=new TheoraEvent;
+	mThread=new TheoraReadAheadThread(this);
+	mThread->startThread();
+}
+
+TheoraReadAheadDataSource::~TheoraReadAheadDataSource()
+{
+	mThread->stopThread();
+	mSpaceEvent->signal();
+	mThread->waitforThread();
+	delete mThread;
+	delete mDataEvent;
+	delete mSpaceEvent;
+	delete mSourceMutex;
+	delete mMutex;
+	delete [] mChunk;
+	delete [] mBuffer;
+	delete mSource;
+}
+
+bool TheoraReadAheadDataSource::_fill()
+{
+	mMutex->lock();
+	unsigned long pos=mWindowStart+mFilled,n=mWindowSize-mFilled,size=mSize;
+	unsigned int generation=mGeneration;
+	mMutex->unlock();
+
+	if (pos >= size) return 0;
+	if (n > mChunkSize) n=mChunkSize;
+	if (pos+n > size) n=size-pos;
+	// wait until a whole chunk fits, unless it's the end of the source
+	if (n < mChunkSize && pos+n < size) return 0;
+
+	mSourceMutex->lock();
+	mSource->seek(pos);
+	unsigned long bytesRead=mSource->read(mChunk,n);
+	mSourceMutex->unlock();
+
+	mMutex->lock();
+	if (generation == mGeneration)
+	{
+		if (bytesRead < n) mSize=pos+bytesRead; // the source ended early
+		unsigned long tail=(mHead+mFilled) % mWindowSize,first=mWindowSize-tail;
+		if (first > bytesRead) first=bytesRead;
+		memcpy(mBuffer+tail,mChunk,first);
+		memcpy(mBuffer,mChunk+first,bytesRead-first);
+		mFilled+=bytesRead;
+	}
+	mMutex->unlock();
+	mDataEvent->signal();
+	return 1;
+}
+
+int TheoraReadAheadDataSource::read(void* output,int nBytes)
+{
+	unsigned char* out=(unsigned char*) output;
+	int total=0;
+	bool missed=0;
+	double start=0;
+
+	mMutex->lock();
+	while (nBytes > 0 && mReadPointer < mSize)
+	{
+		if (mReadPointer >= mWindowStart && mReadPointer < mWindowStart+mFilled)
+		{
+			// drop the bytes before the read pointer and copy from the window
+			unsigned long skip=mReadPointer-mWindowStart,n=mFilled-skip,first;
+			mHead=(mHead+skip) % mWindowSize;
+			mWindowStart=mReadPointer;
+			mFilled=n;
+			if (n > (unsigned long) nBytes) n=nBytes;
+			first=mWindowSize-mHead;
+			if (first > n) first=n;
+			memcpy(out,mBuffer+mHead,first);
+			memcpy(out+first,mBuffer,n-first);
+			mHead=(mHead+n) % mWindowSize;
+			mWindowStart+=n;
+			mFilled-=n;
+			mReadPointer+=n;
+			out+=n;
+			total+=n;
+			nBytes-=n;
+			mSpaceEvent->signal();
+			continue;
+		}
+
+		if (!missed) { missed=1; start=_getTime(); }
+		if (mReadPointer == mWindowStart+mFilled || mReadPointer == mMissEnd)
+		{
+			// sequential read past the buffered data, restart the window at the
+			// read pointer and wait for the I/O thread
+			if (mReadPointer == mWindowStart+mFilled) mHead=(mHead+mFilled) % mWindowSize;
+			else
+			{
+				mHead=0;
+				mGeneration++;
+			}
+			mWindowStart=mReadPointer;
+			mFilled=0;
+			mSpaceEvent->signal();
+			unsigned int events=mDataEvent->getCount();
+			mMutex->unlock();
+			mDataEvent->wait(events);
+			mMutex->lock();
+		}
+		else
+		{
+			// random access, read around the window
+			unsigned long pos=mReadPointer;
+			mMutex->unlock();
+			mSourceMutex->lock();
+			mSource->seek(pos);
+			int n=mSource->read(out,nBytes);
+			mSourceMutex->unlock();
+			mMutex->lock();
+			mReadPointer=mMissEnd=pos+n;
+			total+=n;
+			break;
+		}
+	}
+	if (missed)
+	{
+		mNumMisses++;
+		mStallTime+=_getTime()-start;
+	}
+	else mNumHits++;
+	mMutex->unlock();
+	return total;
+}
+
+void TheoraReadAheadDataSource::seek(unsigned long byte_index)
+{
+	mMutex->lock();
+	mReadPointer=byte_index;
+	mMutex->unlock();
+}
+
+unsigned long TheoraReadAheadDataSource::size()
+{
+	// the wrapped source belongs to the I/O thread, and _fill() shortens mSize if it ends early
+	mMutex->lock();
+	unsigned long size=mSize;
+	mMutex->unlock();
+	return size;
+}
+
+unsigned long TheoraReadAheadDataSource::tell()
+{
+	mMutex->lock();
+	unsigned long pos=mReadPointer;
+	mMutex->unlock();
+	return pos;
+}
+
+unsigned long TheoraReadAheadDataSource::getNumHits()
+{
+	mMutex->lock();
+	unsigned long n=mNumHits;
+	mMutex->unlock();
+	return n;
+}
+
+unsigned long TheoraReadAheadDataSource::getNumMisses()
+{
+	mMutex->lock();
+	unsigned long n=mNumMisses;
+	mMutex->unlock();
+	return n;
+}
+
+float TheoraReadAheadDataSource::getStallTime()
+{
+	mMutex->lock();
+	float time=(float) mStallTime;
+	mMutex->unlock();
+	return time;
+}
@@ -0,0 +1,141 @@
+/************************************************************************************
+This source file is part of the Theora Video Playback Library
+For latest info, see http://libtheoraplayer.sourceforge.net/
+*************************************************************************************
+Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
+This program is free software; you can redistribute it and/or modify it under
+the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
+*************************************************************************************/
+#include <stdlib.h>
+#include <stdint.h>
+#include "TheoraFramePool.h"
+#include "TheoraUtil.h"
+#include "TheoraException.h"
+
+// the pointer returned by malloc is stored right before the aligned buffer
+static unsigned char* _allocAligned(size_t size)
+{
+	unsigned char* raw=(unsigned char*) malloc(size+TH_FRAME_BUFFER_ALIGNMENT-1+sizeof(void*));
+	if (!raw) return NULL;
+	uintptr_t p=((uintptr_t) raw+sizeof(void*)+TH_FRAME_BUFFER_ALIGNMENT-1) & ~(uintptr_t) (TH_FRAME_BUFFER_ALIGNMENT-1);
+	((void**) p)[-1]=raw;
+	return (unsigned char*) p;
+}
+
+static void _freeAligned(unsigned char* buffer)
+{
+	free(((void**) buffer)[-1]);
+}
+
+TheoraFramePool::TheoraFramePool()
+{
+	mLimit=64*1024*1024;
+	mBudgetLimit=(size_t) -1;
+	mStats.numAllocations=mStats.numReuses=mStats.numFrees=0;
+	mStats.bytesInUse=mStats.bytesIdle=mStats.peakBytes=0;
+}
+
+TheoraFramePool::~TheoraFramePool()
+{
+	mMutex.lock();
+	_trim(0);
+	mMutex.unlock();
+}
+
+size_t TheoraFramePool::_getSizeClass(size_t size)
+{
+	size_t step=TH_FRAME_BUFFER_ALIGNMENT;
+	while (step*16 <= size) step*=2;
+	return (size+step-1)/step*step;
+}
+
+unsigned char* TheoraFramePool::acquire(size_t size,bool* allocated)
+{
+	size_t cls=_getSizeClass(size);
+	unsigned char* buffer=NULL;
+	mMutex.lock();
+	std::vector<unsigned char*>& idle=mIdle[cls];
+	if (!idle.empty())
+	{
+		buffer=idle.back();
+		idle.pop_back();
+		mStats.bytesIdle-=cls;
+		mStats.bytesInUse+=cls;
+		mStats.numReuses++;
+	}
+	mMutex.unlock();
+	if (allocated) *allocated=(buffer == NULL);
+	if (buffer) return buffer;
+
+	// allocate outside the lock, other clips' worker threads may be waiting for buffers
+	buffer=_allocAligned(cls);
+	if (!buffer) throw TheoraGenericException("Unable to allocate a frame buffer of "+str((int) cls)+" bytes");
+	mMutex.lock();
+	mStats.bytesInUse+=cls;
+	mStats.numAllocations++;
+	if (mStats.bytesInUse+mStats.bytesIdle > mStats.peakBytes) mStats.peakBytes=mStats.bytesInUse+mStats.bytesIdle;
+	mMutex.unlock();
+	return buffer;
+}
+
+void TheoraFramePool::release(unsigned char* buffer,size_t size)
+{
+	size_t cls=_getSizeClass(size);
+	mMutex.lock();
+	mStats.bytesInUse-=cls;
+	if (mStats.bytesIdle+cls <= _getIdleLimit())
+	{
+		mIdle[cls].push_back(buffer);
+		mStats.bytesIdle+=cls;
+		buffer=NULL;
+	}
+	else mStats.numFrees++;
+	mMutex.unlock();
+	if (buffer) _freeAligned(buffer);
+}
+
+void TheoraFramePool::_trim(size_t limit)
+{
+	std::map<size_t,std::vector<unsigned char*> >::reverse_iterator it;
+	for (it=mIdle.rbegin();it != mIdle.rend() && mStats.bytesIdle > limit;it++)
+	{
+		while (!it->second.empty() && mStats.bytesIdle > limit)
+		{
+			_freeAligned(it->second.back());
+			it->second.pop_back();
+			mStats.bytesIdle-=it->first;
+			mStats.numFrees++;
+		}
+	}
+}
+
+void TheoraFramePool::setLimit(size_t bytes)
+{
+	mMutex.lock();
+	mLimit=bytes;
+	_trim(_getIdleLimit());
+	mMutex.unlock();
+}
+
+void TheoraFramePool::setBudgetLimit(size_t bytes)
+{
+	mMutex.lock();
+	mBudgetLimit=bytes;
+	_trim(_getIdleLimit());
+	mMutex.unlock();
+}
+
+void TheoraFramePool::trim()
+{
+	mMutex.lock();
+	_trim(0);
+	mMutex.unlock();
+}
+
+TheoraFramePoolStats TheoraFramePool::getStats()
+{
+	mMutex.lock();
+	TheoraFramePoolStats stats=mStats;
+	mMutex.unlock();
+	return stats;
+}
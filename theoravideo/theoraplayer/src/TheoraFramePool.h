@@ -0,0 +1,71 @@
+/************************************************************************************
+This source file is part of the Theora Video Playback Library
+For latest info, see http://libtheoraplayer.sourceforge.net/
+*************************************************************************************
+Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
+This program is free software; you can redistribute it and/or modify it under
+the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
+*************************************************************************************/
+#ifndef _TheoraFramePool_h
+#define _TheoraFramePool_h
+
+#include <map>
+#include <vector>
+#include "TheoraAsync.h"
+#include "TheoraVideoManager.h"
+
+//! alignment of pooled frame buffers in bytes, enough for any SIMD kernel and a cache line
+#define TH_FRAME_BUFFER_ALIGNMENT 64
+
+/**
+	Frame buffers shared by all clips. Buffers are rounded up to a size class and kept
+	when frames are destroyed, so recreating frame queues (new clips, output mode or
+	queue size changes) reuses memory instead of allocating and freeing large blocks.
+
+	Size classes are multiples of an eighth of the power of two below the size, which
+	wastes at most 12.5% per buffer while letting clips of similar resolutions share
+	buffers. Idle buffers beyond the limit are freed.
+*/
+class TheoraFramePool
+{
+protected:
+	TheoraMutex mMutex;
+	//! idle buffers by size class
+	std::map<size_t,std::vector<unsigned char*> > mIdle;
+	//! max bytes of idle buffers kept
+	size_t mLimit;
+	//! lower cap on idle bytes while the manager has a frame memory budget, see setBudgetLimit()
+	size_t mBudgetLimit;
+	TheoraFramePoolStats mStats;
+
+	//! returns the size class a buffer of 'size' bytes is allocated with
+	static size_t _getSizeClass(size_t size);
+	//! frees idle buffers, largest first, until at most 'limit' bytes are left. mMutex must be locked
+	void _trim(size_t limit);
+	//! returns the max bytes of idle buffers kept, the lower of both limits
+	size_t _getIdleLimit() { return (mBudgetLimit < mLimit) ? mBudgetLimit : mLimit; }
+public:
+	TheoraFramePool();
+	~TheoraFramePool();
+
+	/**
+		returns an aligned buffer of at least 'size' bytes, its contents are undefined.
+		if 'allocated' is given, it's set to true when the buffer is new rather than reused
+	*/
+	unsigned char* acquire(size_t size,bool* allocated=NULL);
+	//! gives a buffer returned by acquire() for the same size back to the pool
+	void release(unsigned char* buffer,size_t size);
+
+	void setLimit(size_t bytes);
+	size_t getLimit() { return mLimit; }
+	/**
+		caps idle buffers to what's left of the frame memory budget, on top of the limit.
+		set by TheoraVideoManager, (size_t) -1 when there is no budget
+	*/
+	void setBudgetLimit(size_t bytes);
+	//! frees all idle buffers
+	void trim();
+	TheoraFramePoolStats getStats();
+};
+
+#endif
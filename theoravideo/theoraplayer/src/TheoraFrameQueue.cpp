@@ -6,108 +6,297 @@ Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
 This program is free software; you can redistribute it and/or modify it under
 the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
 *************************************************************************************/
+#include <algorithm>
 #include "TheoraFrameQueue.h"
 #include "TheoraVideoFrame.h"
+#include "TheoraVideoClip.h"
 #include "TheoraUtil.h"
 
 
-TheoraFrameQueue::TheoraFrameQueue(int n,TheoraVideoClip* parent)
+TheoraFrameQueue::TheoraFrameQueue(int n,TheoraVideoClip* parent) :
+	mHead(0),
+	mTail(0),
+	mLimit(0)
 {
 	mParent=parent;
-	setSize(n);
+	mRefs=0;
+	mSize=n;
+	reset();
 }
 
 TheoraFrameQueue::~TheoraFrameQueue()
 {
-	foreach_l(TheoraVideoFrame*,mQueue)
+	foreach(TheoraVideoFrame*,mFrames)
 		delete (*it);
-	mQueue.clear();
+	mFrames.clear();
+	if (mRefs) delete [] mRefs;
+}
+
+void TheoraFrameQueue::reset()
+{
+	mMutex.lock();
+	foreach(TheoraVideoFrame*,mFrames)
+	{
+		if ((*it)->hasExternalBuffer()) mParent->_releaseOutputBuffer(*it);
+		delete (*it);
+	}
+	mFrames.clear();
+	for (int i=0;i<mSize;i++)
+		mFrames.push_back(new TheoraVideoFrame(mParent));
+	if (mRefs) delete [] mRefs;
+	mRefs=new std::atomic<int>[mSize > 0 ? mSize : 1];
+	for (int i=0;i<mSize;i++) mRefs[i]=0;
+	mHead=mTail=0;
+	foreach(std::atomic<unsigned int>*,mViewHeads)
+		(*it)->store(0);
+
+	mMutex.unlock();
 }
 
 void TheoraFrameQueue::setSize(int n)
 {
 	mMutex.lock();
-	if (mQueue.size() > 0)
+	unsigned int size=mFrames.size(),tail=mTail.load(std::memory_order_acquire),
+	             first=mHead.load(std::memory_order_acquire),live,i,m;
+	// the oldest frame a reader hasn't popped yet, the clip or a view that lags behind
+	foreach(std::atomic<unsigned int>*,mViewHeads)
+		if (tail-(*it)->load(std::memory_order_acquire) > tail-first) first=(*it)->load(std::memory_order_acquire);
+	live=tail-first;
+	m=std::max((unsigned int) n,live);
+
+	// unpopped frames move to the front of the ring in presentation order, followed by
+	// free frames. those holding application buffers or frame buffers are kept first
+	std::vector<TheoraVideoFrame*> frames,spare;
+	std::atomic<int>* refs=new std::atomic<int>[m > 0 ? m : 1];
+	for (i=0;i<m;i++) refs[i]=0;
+	for (i=0;i<live;i++)
 	{
-		foreach_l(TheoraVideoFrame*,mQueue)
-			delete (*it);
-		mQueue.clear();
+		frames.push_back(mFrames[(first+i) % size]);
+		refs[i]=mRefs[(first+i) % size].load(std::memory_order_acquire);
 	}
-for (int i=0;i<n;i++)
-		mQueue.push_back(new TheoraVideoFrame(mParent));
+	for (i=live;i<size;i++)
+		if (mFrames[(first+i) % size]->hasExternalBuffer()) frames.push_back(mFrames[(first+i) % size]);
+	for (i=live;i<size;i++)
+		if (!mFrames[(first+i) % size]->hasExternalBuffer()) spare.push_back(mFrames[(first+i) % size]);
+	foreach(TheoraVideoFrame*,spare)
+		if ((*it)->_hasOwnBuffer()) frames.push_back(*it);
+	foreach(TheoraVideoFrame*,spare)
+		if (!(*it)->_hasOwnBuffer()) frames.push_back(*it);
+	for (i=m;i<frames.size();i++)
+	{
+		// a frame that didn't fit, but got an application buffer, hands it to the next frame
+		if (frames[i]->hasExternalBuffer()) mParent->_requeueOutputBuffer(frames[i]);
+		delete frames[i];
+	}
+	frames.resize(m,NULL);
+	for (i=0;i<m;i++)
+		if (!frames[i]) frames[i]=new TheoraVideoFrame(mParent);
+
+	mFrames.swap(frames);
+	if (mRefs) delete [] mRefs;
+	mRefs=refs;
+	foreach(std::atomic<unsigned int>*,mViewHeads)
+		(*it)->store((*it)->load(std::memory_order_relaxed)-first,std::memory_order_release);
+	mHead.store(mHead.load(std::memory_order_relaxed)-first,std::memory_order_release);
+	mTail.store(live,std::memory_order_release);
+	mSize=n;
 
 	mMutex.unlock();
 }
 
 int TheoraFrameQueue::getSize()
 {
-	return mQueue.size();
+	return mSize;
+}
+
+void TheoraFrameQueue::setLimit(int n)
+{
+	mLimit.store(n > 0 ? n : 0,std::memory_order_release);
+}
+
+int TheoraFrameQueue::getLimit()
+{
+	return _getCapacity();
+}
+
+int TheoraFrameQueue::getFrameBufferSize()
+{
+	return mFrames.empty() ? 0 : mFrames[0]->getBufferSize();
+}
+
+unsigned int TheoraFrameQueue::_getCapacity()
+{
+	unsigned int n=mLimit.load(std::memory_order_acquire);
+	return (n > 0 && n < (unsigned int) mSize) ? n : mSize;
+}
+
+void TheoraFrameQueue::_moveBuffers(unsigned int tail)
+{
+	unsigned int size=mFrames.size(),capacity=_getCapacity(),n=0,i,slot;
+	if (capacity == size) return;
+	TheoraVideoFrame* frame=mFrames[tail % size];
+	// free frames are the ones every reader popped. the last queued frame is skipped as
+	// well, the clip compares the next frame against it for dirty tile tracking
+	for (i=0;i<size;i++)
+	{
+		slot=(tail+i) % size;
+		if (mFrames[slot]->_hasOwnBuffer()) n++;
+		if (i == 0 || i == size-1 || mRefs[slot].load(std::memory_order_acquire) != 0) continue;
+		if (!frame->_hasOwnBuffer() && mFrames[slot]->_hasOwnBuffer())
+			frame->_takeOwnBuffer(mFrames[slot]);
+	}
+	for (i=1;i<size-1 && n > capacity+1;i++)
+	{
+		slot=(tail+i) % size;
+		if (mRefs[slot].load(std::memory_order_acquire) == 0 && mFrames[slot]->_hasOwnBuffer())
+		{
+			mFrames[slot]->_freeOwnBuffer();
+			n--;
+		}
+	}
 }
 
 TheoraVideoFrame* TheoraFrameQueue::getFirstAvailableFrame()
 {
-	TheoraVideoFrame* frame=0;
-	mMutex.lock();
-	if (mQueue.front()->mReady) frame=mQueue.front();
-	mMutex.unlock();
-	return frame;
+	return getFirstAvailableFrame(&mHead);
+}
+
+TheoraVideoFrame* TheoraFrameQueue::getFirstAvailableFrame(std::atomic<unsigned int>* head)
+{
+	unsigned int h=head->load(std::memory_order_acquire);
+	if (h == mTail.load(std::memory_order_acquire)) return 0;
+	return mFrames[h % mFrames.size()];
 }
 
 void TheoraFrameQueue::clear()
 {
+	// drop all ready frames by moving the heads up to the tail. the CAS loops guard against
+	// pop() running at the same time, clear() can be called by the worker thread (seeking)
 	mMutex.lock();
-	foreach_l(TheoraVideoFrame*,mQueue)
-		(*it)->clear();
+	_clearHead(&mHead);
+	foreach(std::atomic<unsigned int>*,mViewHeads)
+		_clearHead(*it);
 	mMutex.unlock();
 }
 
+void TheoraFrameQueue::_clearHead(std::atomic<unsigned int>* head)
+{
+	unsigned int tail=mTail.load(std::memory_order_acquire),h=head->load(std::memory_order_acquire);
+	while (!head->compare_exchange_weak(h,tail,std::memory_order_acq_rel));
+	// frames a concurrent pop() got to first were released by it
+	for (;h != tail;h++) _release(h);
+}
+
+void TheoraFrameQueue::_release(unsigned int index)
+{
+	std::atomic<int>& refs=mRefs[index % mFrames.size()];
+	TheoraVideoFrame* frame=mFrames[index % mFrames.size()];
+	int n=refs.load(std::memory_order_acquire);
+	for (;;)
+	{
+		// the last reader frees the frame before dropping its reference, once the count
+		// is zero requestEmptyFrame() can hand the frame to the decoder. an application
+		// buffer belongs to the application again once every reader is done with it,
+		// whether the frame was displayed, dropped or flushed
+		if (n == 1)
+		{
+			frame->clear();
+			if (frame->hasExternalBuffer()) mParent->_releaseOutputBuffer(frame);
+		}
+		if (refs.compare_exchange_weak(n,n-1,std::memory_order_acq_rel)) break;
+	}
+}
+
 void TheoraFrameQueue::pop()
+{
+	pop(&mHead);
+}
+
+void TheoraFrameQueue::pop(std::atomic<unsigned int>* head)
+{
+	unsigned int h=head->load(std::memory_order_acquire);
+	if (h == mTail.load(std::memory_order_acquire)) return;
+	// if clear() flushed the queue in the meantime there's nothing left to pop
+	if (head->compare_exchange_strong(h,h+1,std::memory_order_acq_rel)) _release(h);
+}
+
+void TheoraFrameQueue::addView(std::atomic<unsigned int>* head)
 {
 	mMutex.lock();
-	TheoraVideoFrame* first=mQueue.front();
-	first->clear();
-	mQueue.pop_front();
-	mQueue.push_back(first);
+	head->store(mTail.load(std::memory_order_acquire));
+	mViewHeads.push_back(head);
 	mMutex.unlock();
 }
 
-TheoraVideoFrame* TheoraFrameQueue::requestEmptyFrame()
+void TheoraFrameQueue::removeView(std::atomic<unsigned int>* head)
 {
-	TheoraVideoFrame* frame=0;
 	mMutex.lock();
-	foreach_l(TheoraVideoFrame*,mQueue)
-	{
-		if (!(*it)->mInUse)
+	foreach(std::atomic<unsigned int>*,mViewHeads)
+		if (*it == head)
 		{
-			(*it)->mInUse=true;
-			(*it)->mReady=false;
-			frame=(*it);
+			mViewHeads.erase(it);
+			_clearHead(head);
 			break;
 		}
+	mMutex.unlock();
+}
+
+TheoraVideoFrame* TheoraFrameQueue::requestEmptyFrame()
+{
+	TheoraVideoFrame* frame=0;
+	mMutex.lock();
+	unsigned int tail=mTail.load(std::memory_order_relaxed);
+	if (tail-mHead.load(std::memory_order_acquire) < _getCapacity() &&
+		mRefs[tail % mFrames.size()].load(std::memory_order_acquire) == 0)
+	{
+		frame=mFrames[tail % mFrames.size()];
+		frame->mInUse=true;
+		frame->mReady=false;
+		_moveBuffers(tail);
 	}
 	mMutex.unlock();
 	return frame;
 }
 
-int TheoraFrameQueue::getUsedCount()
+void TheoraFrameQueue::push(TheoraVideoFrame* frame)
 {
+	unsigned int tail=mTail.load(std::memory_order_relaxed);
+	if (frame != mFrames[tail % mFrames.size()]) return;
+	// the views are counted under the mutex, so addView() can't miss this frame or count it twice
 	mMutex.lock();
-	int n=0;
-	foreach_l(TheoraVideoFrame*,mQueue)
-		if ((*it)->mInUse) n++;
+	mRefs[tail % mFrames.size()].store(1+mViewHeads.size(),std::memory_order_relaxed);
+	// release: frame data written by the worker becomes visible before the frame does
+	mTail.store(tail+1,std::memory_order_release);
 	mMutex.unlock();
+}
+
+bool TheoraFrameQueue::hasEmptyFrame()
+{
+	unsigned int tail=mTail.load(std::memory_order_acquire);
+	return tail-mHead.load(std::memory_order_acquire) < _getCapacity() &&
+	       mRefs[tail % mFrames.size()].load(std::memory_order_acquire) == 0;
+}
+
+int TheoraFrameQueue::getUsedCount()
+{
+	unsigned int head=mHead.load(std::memory_order_acquire),tail=mTail.load(std::memory_order_acquire);
+	int n=tail-head;
+	if (n < (int) mFrames.size() && mFrames[tail % mFrames.size()]->mInUse) n++;
 	return n;
 }
 
 int TheoraFrameQueue::getReadyCount()
 {
-	mMutex.lock();
-	int n=0;
-	foreach_l(TheoraVideoFrame*,mQueue)
-		if ((*it)->mReady) n++;
-	mMutex.unlock();
-	return n;
+	return getReadyCount(&mHead);
 }
+
+int TheoraFrameQueue::getReadyCount(std::atomic<unsigned int>* head)
+{
+	// head is read first, so the tail can only be newer and the difference never negative
+	unsigned int h=head->load(std::memory_order_acquire);
+	return mTail.load(std::memory_order_acquire)-h;
+}
+
 void TheoraFrameQueue::lock()
 {
 	mMutex.lock();
@@ -116,4 +305,4 @@ void TheoraFrameQueue::lock()
 void TheoraFrameQueue::unlock()
 {
 	mMutex.unlock();
-}
\ No newline at end of file
+}
@@ -0,0 +1,72 @@
+/************************************************************************************
+This source file is part of the Theora Video Playback Library
+For latest info, see http://libtheoraplayer.sourceforge.net/
+*************************************************************************************
+Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
+This program is free software; you can redistribute it and/or modify it under
+the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
+*************************************************************************************/
+#include "TheoraLoopCache.h"
+#include "TheoraVideoFrame.h"
+#include "TheoraUtil.h"
+
+TheoraLoopCache::TheoraLoopCache()
+{
+	mSize=mFrameSize=mNextFrame=0;
+	mValid=0;
+	mRejectedBudget=0;
+}
+
+TheoraLoopCache::~TheoraLoopCache()
+{
+	clear();
+}
+
+void TheoraLoopCache::clear()
+{
+	foreach(TheoraLoopCache::Entry,mFrames)
+		delete [] it->data;
+	mFrames.clear();
+	mSize=mFrameSize=mNextFrame=0;
+	mValid=0;
+}
+
+bool TheoraLoopCache::add(unsigned long frameNumber,float time,TheoraVideoFrame* frame,unsigned long budget)
+{
+	unsigned long size=frame->getBufferSize();
+	if (frameNumber == 0)
+	{
+		// start of a new pass, frames of the previous one may be in a different format
+		clear();
+		mValid=(budget != mRejectedBudget);
+		mFrameSize=size;
+	}
+	if (!mValid) return 1;
+	if (frameNumber != mNextFrame || size != mFrameSize)
+	{
+		clear(); // a frame is missing, eg. after seeking
+		return 1;
+	}
+	if (mSize+size > budget)
+	{
+		clear();
+		mRejectedBudget=budget;
+		return 0;
+	}
+	Entry e;
+	e.data=new unsigned char[size];
+	frame->_copyTo(e.data);
+	e.time=time;
+	e.frame=frameNumber;
+	mFrames.push_back(e);
+	mSize+=size;
+	mNextFrame++;
+	return 1;
+}
+
+void TheoraLoopCache::addDuplicate(unsigned long frameNumber)
+{
+	if (!mValid) return;
+	if (frameNumber == mNextFrame) mNextFrame++;
+	else clear();
+}
@@ -0,0 +1,71 @@
+/************************************************************************************
+This source file is part of the Theora Video Playback Library
+For latest info, see http://libtheoraplayer.sourceforge.net/
+*************************************************************************************
+Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
+This program is free software; you can redistribute it and/or modify it under
+the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
+*************************************************************************************/
+#ifndef _TheoraLoopCache_h
+#define _TheoraLoopCache_h
+
+#include <vector>
+
+class TheoraVideoFrame;
+
+/**
+	Copies of every converted frame of a clip, filled in during one pass through the
+	file. Once a pass finishes without missing a frame, TheoraVideoClip replays further
+	loops from this cache instead of demuxing and decoding them again.
+
+	Only used by the thread that decodes the clip, so it isn't guarded by a mutex
+*/
+class TheoraLoopCache
+{
+public:
+	struct Entry
+	{
+		//! copy of the frame buffer
+		unsigned char* data;
+		//! display time of the frame
+		float time;
+		//! number of the frame in the theora stream
+		unsigned long frame;
+	};
+protected:
+	std::vector<Entry> mFrames;
+	//! number of bytes used by the cached frames and the size of one frame
+	unsigned long mSize,mFrameSize;
+	//! number of the frame expected next in the current pass
+	unsigned long mNextFrame;
+	//! false if the current pass missed a frame, nothing is added until the next pass starts
+	bool mValid;
+	//! budget that was exceeded by the last pass, passes aren't cached again until the budget changes
+	unsigned long mRejectedBudget;
+public:
+	TheoraLoopCache();
+	~TheoraLoopCache();
+
+	//! frees all frames, the current pass can't be cached anymore
+	void clear();
+	/**
+		adds a copy of a converted frame. frame 0 starts a new pass, other frames are
+		only added if they directly follow the last cached one, otherwise (eg. after
+		seeking or dropping a frame) the pass can't be cached. returns false if the
+		frame doesn't fit in the budget, all frames are freed in that case
+	*/
+	bool add(unsigned long frameNumber,float time,TheoraVideoFrame* frame,unsigned long budget);
+	//! skips a duplicate frame, which isn't stored because it's never displayed on its own
+	void addDuplicate(unsigned long frameNumber);
+	//! returns true if the cache holds every frame from the first one up to the last one added
+	bool isComplete() { return mValid && !mFrames.empty(); }
+
+	int getNumFrames() { return mFrames.size(); }
+	Entry* getFrame(int index) { return &mFrames[index]; }
+	//! returns the number of bytes used by the cached frames
+	unsigned long getSize() { return mSize; }
+	//! returns the size of a frame in bytes
+	unsigned long getFrameSize() { return mFrameSize; }
+};
+
+#endif
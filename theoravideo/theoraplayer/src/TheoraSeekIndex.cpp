@@ -0,0 +1,146 @@
+/************************************************************************************
+This source file is part of the Theora Video Playback Library
+For latest info, see http://libtheoraplayer.sourceforge.net/
+*************************************************************************************
+Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
+This program is free software; you can redistribute it and/or modify it under
+the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
+*************************************************************************************/
+#define _CRT_SECURE_NO_WARNINGS // MSVC++
+#include <stdio.h>
+#include "TheoraSeekIndex.h"
+#include "TheoraUtil.h"
+
+// index files are written in native byte order, a file from a machine with a different
+// byte order fails the magic number check and gets rebuilt
+#define TH_SEEK_INDEX_MAGIC   0x49534854 // "THSI"
+#define TH_SEEK_INDEX_VERSION 1
+
+TheoraSeekIndex::TheoraSeekIndex()
+{
+	clear();
+}
+
+void TheoraSeekIndex::clear()
+{
+	mEntries.clear();
+	mStart=mEnd=0;
+	mEmpty=1;
+}
+
+void TheoraSeekIndex::addPage(unsigned long offset,unsigned long length,ogg_int64_t granule,long frame,long keyframe)
+{
+	if (mEmpty)
+	{
+		mStart=mEnd=offset;
+		mEmpty=0;
+	}
+	if (offset != mEnd) return;
+	mEnd=offset+length;
+	if (frame < 0 || (!mEntries.empty() && frame < mEntries.back().frame)) return;
+
+	Entry e;
+	e.offset=offset;
+	e.granule=granule;
+	e.frame=frame;
+	e.keyframe=keyframe;
+	mEntries.push_back(e);
+}
+
+bool TheoraSeekIndex::find(long targetFrame,bool complete,Entry* page,long* keyframe)
+{
+	int n=mEntries.size(),lo=0,hi=n,mid;
+	// first page that finishes the target frame or a later one
+	while (lo < hi)
+	{
+		mid=(lo+hi)/2;
+		if (mEntries[mid].frame < targetFrame) lo=mid+1;
+		else                                   hi=mid;
+	}
+	if (lo == 0) return 0; // the target is before the indexed range
+	if (lo == n && !complete) return 0; // the target is after the indexed range
+
+	// the keyframe is either the one of the page finishing the target frame, or if that
+	// page finishes later frames as well, it might be the one of the previous page
+	long k=mEntries[lo-1].keyframe;
+	if (lo < n && mEntries[lo].keyframe <= targetFrame) k=mEntries[lo].keyframe;
+
+	// last page that only finishes frames before the keyframe
+	for (hi=lo,lo=0;lo < hi;)
+	{
+		mid=(lo+hi)/2;
+		if (mEntries[mid].frame < k) lo=mid+1;
+		else                         hi=mid;
+	}
+	if (lo == 0) return 0; // an earlier, unindexed page might hold the start of the keyframe
+	*page=mEntries[lo-1];
+	*keyframe=k;
+	return 1;
+}
+
+bool TheoraSeekIndex::save(std::string filename,unsigned long file_size,long serialno)
+{
+	FILE* f=fopen(filename.c_str(),"wb");
+	if (!f) return 0;
+
+	ogg_int64_t header[7]={TH_SEEK_INDEX_MAGIC,TH_SEEK_INDEX_VERSION,(ogg_int64_t) file_size,
+	                       serialno,(ogg_int64_t) mStart,(ogg_int64_t) mEnd,(ogg_int64_t) mEntries.size()};
+	bool ret=fwrite(header,sizeof(header),1,f) == 1;
+	ogg_int64_t e[4];
+	foreach(TheoraSeekIndex::Entry,mEntries)
+	{
+		if (!ret) break;
+		e[0]=it->offset; e[1]=it->granule; e[2]=it->frame; e[3]=it->keyframe;
+		ret=fwrite(e,sizeof(e),1,f) == 1;
+	}
+	if (fclose(f) != 0) ret=0;
+	return ret;
+}
+
+bool TheoraSeekIndex::load(std::string filename,unsigned long file_size,long serialno)
+{
+	FILE* f=fopen(filename.c_str(),"rb");
+	if (!f) return 0;
+
+	ogg_int64_t header[7];
+	if (fread(header,sizeof(header),1,f) != 1 ||
+		header[0] != TH_SEEK_INDEX_MAGIC || header[1] != TH_SEEK_INDEX_VERSION ||
+		header[2] != (ogg_int64_t) file_size || header[3] != serialno ||
+		header[4] < 0 || header[4] > header[5] || header[5] > (ogg_int64_t) file_size ||
+		header[6] < 0 || header[6] > (header[5]-header[4])/27) // 27 bytes is the smallest ogg page
+	{
+		fclose(f);
+		return 0;
+	}
+	std::vector<Entry> entries;
+	Entry entry;
+	ogg_int64_t e[4];
+	for (ogg_int64_t i=0;i<header[6];i++)
+	{
+		if (fread(e,sizeof(e),1,f) != 1)
+		{
+			fclose(f);
+			return 0;
+		}
+		// find() relies on entries being sorted and doSeek() reads at their offsets, so a
+		// corrupt entry rejects the whole file. entries are in the order addPage() adds them
+		if (e[0] < header[4] || e[0] >= header[5] || e[2] < 0 || e[3] < 0 || e[3] > e[2] ||
+			(!entries.empty() && (e[0] <= (ogg_int64_t) entries.back().offset || e[2] < entries.back().frame)))
+		{
+			fclose(f);
+			return 0;
+		}
+		entry.offset=(unsigned long) e[0];
+		entry.granule=e[1];
+		entry.frame=(long) e[2];
+		entry.keyframe=(long) e[3];
+		entries.push_back(entry);
+	}
+	fclose(f);
+
+	mEntries.swap(entries);
+	mStart=(unsigned long) header[4];
+	mEnd=(unsigned long) header[5];
+	mEmpty=(mStart == mEnd);
+	return 1;
+}
@@ -0,0 +1,73 @@
+/************************************************************************************
+This source file is part of the Theora Video Playback Library
+For latest info, see http://libtheoraplayer.sourceforge.net/
+*************************************************************************************
+Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
+This program is free software; you can redistribute it and/or modify it under
+the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
+*************************************************************************************/
+#ifndef _TheoraSeekIndex_h
+#define _TheoraSeekIndex_h
+
+#include <string>
+#include <vector>
+#include <ogg/ogg.h>
+
+/**
+	Byte offsets of the theora pages of a file, used by TheoraVideoClip::doSeek() to
+	jump straight to a keyframe instead of bisecting the file.
+
+	The index covers a single byte range of the file and only grows by pages that
+	directly follow it, so there are never any gaps that could hide a keyframe.
+*/
+class TheoraSeekIndex
+{
+public:
+	struct Entry
+	{
+		//! byte offset of the page in the file
+		unsigned long offset;
+		//! granule position of the page (of the last frame finished on it)
+		ogg_int64_t granule;
+		//! number of the last frame finished on the page and of the keyframe it depends on
+		long frame,keyframe;
+	};
+protected:
+	//! pages that finish a theora frame, in file order
+	std::vector<Entry> mEntries;
+	//! the indexed byte range is [mStart,mEnd)
+	unsigned long mStart,mEnd;
+	bool mEmpty;
+public:
+	TheoraSeekIndex();
+
+	void clear();
+	/**
+		adds a page of 'length' bytes found at 'offset' if it directly follows the
+		indexed range (or starts it, if the index is empty). Pages that don't
+		finish a theora frame are passed with frame -1, they only extend the range
+	*/
+	void addPage(unsigned long offset,unsigned long length,ogg_int64_t granule,long frame,long keyframe);
+	//! returns true if no pages were added yet
+	bool isEmpty() { return mEmpty; }
+	//! end of the indexed range, this is where scanning the rest of the file continues
+	unsigned long getEnd() { return mEnd; }
+	int getNumEntries() { return mEntries.size(); }
+	/**
+		finds the keyframe that targetFrame depends on and the last page before it,
+		which is where decoding has to start because the keyframe's packet can begin
+		on that page. complete should be true if the index reaches the end of the file.
+		returns false if the index doesn't cover that part of the file
+	*/
+	bool find(long targetFrame,bool complete,Entry* page,long* keyframe);
+
+	/**
+		saves the index to a file. the file size and serial number of the theora
+		stream are stored along with it so load() can reject stale index files
+	*/
+	bool save(std::string filename,unsigned long file_size,long serialno);
+	//! loads an index saved with save(), returns false if the file is missing or doesn't match
+	bool load(std::string filename,unsigned long file_size,long serialno);
+};
+
+#endif
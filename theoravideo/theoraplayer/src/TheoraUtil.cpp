@@ -18,6 +18,7 @@ the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
 #pragma warning( disable: 4996 ) // MSVC++
 #else
 #include <unistd.h>
+#include <sys/time.h>
 #endif
 
 std::string str(int i)
@@ -43,6 +44,20 @@ void _psleep(int milliseconds)
 #endif
 }
 
+double _getTime()
+{
+#ifndef _WIN32
+	timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+#else
+	LARGE_INTEGER freq,counter;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&counter);
+	return (double) counter.QuadPart/freq.QuadPart;
+#endif
+}
+
 
 int _nextPow2(int x)
 {
@@ -7,6 +7,7 @@ This program is free software; you can redistribute it and/or modify it under
 the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
 *************************************************************************************/
 #include <memory.h>
+#include <deque>
 #include <ogg/ogg.h>
 #include <vorbis/vorbisfile.h>
 #include <theora/theoradec.h>
@@ -19,6 +20,30 @@ the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
 #include "TheoraDataSource.h"
 #include "TheoraUtil.h"
 #include "TheoraException.h"
+#include "TheoraConversion.h"
+#include "TheoraSeekIndex.h"
+#include "TheoraVideoClipView.h"
+#include "TheoraLoopCache.h"
+
+//! size of the chunks read when scanning the file for the seek index, holds at least one full ogg page
+#define TH_SEEK_INDEX_SCAN_CHUNK 65536
+//! largest possible ogg page: 27 byte header, 255 lacing values and 255 segments of 255 bytes
+#define TH_MAX_PAGE_SIZE 65307
+//! size of each read of the scan for the last theora page, consecutive reads overlap by a maximum page size
+#define TH_DURATION_SCAN_WINDOW (2*TH_MAX_PAGE_SIZE)
+//! how far from the end of the file the scan for the last theora page gives up
+#define TH_DURATION_SCAN_MAX (1024*1024)
+//! bounds of the automatically chosen demuxer read size, see _updateReadChunkSize().
+//! headers are read in the smallest chunks, they are small and the data rate isn't known yet
+#define TH_MIN_READ_CHUNK_SIZE 4096
+#define TH_MAX_READ_CHUNK_SIZE 65536
+//! adaptive post-processing steps down when decoding a frame takes longer than this share of
+//! the frame interval, and up when it takes less than the lower share
+#define TH_PP_STEP_DOWN_LOAD 0.8f
+#define TH_PP_STEP_UP_LOAD   0.5f
+//! number of frames decoded at a post-processing level before it's stepped down or up again
+#define TH_PP_STEP_DOWN_FRAMES 8
+#define TH_PP_STEP_UP_FRAMES   60
 
 class TheoraInfoStruct
 {
@@ -38,6 +63,11 @@ public:
 	vorbis_dsp_state VorbisDSPState;
 	vorbis_block     VorbisBlock;
 	vorbis_comment   VorbisComment;
+	//! demuxed theora packets waiting to be decoded, packet data is owned by the queue.
+	//! a packet with no data marks the point where the demuxer restarted the stream
+	std::deque<ogg_packet> Packets;
+	//! application buffers frames can be converted into, with their strides in pixels
+	std::deque<std::pair<unsigned char*,int> > OutputBuffers;
 
 	TheoraInfoStruct()
 	{
@@ -46,6 +76,21 @@ public:
 	}
 };
 
+//! since bitstream version 3.2.1 granule positions count frames from 1, returns 1 for those streams
+int _granuleBias(th_info* info)
+{
+	return info->version_major > 3 || (info->version_major == 3 &&
+	       (info->version_minor > 2 || (info->version_minor == 2 && info->version_subminor >= 1)));
+}
+
+//! same as th_granule_frame(), but doesn't need a decoder instance
+long _granuleFrame(th_info* info,ogg_int64_t granule)
+{
+	ogg_int64_t iframe=granule >> info->keyframe_granule_shift,
+	            pframe=granule-(iframe << info->keyframe_granule_shift);
+	return (long) (iframe+pframe-_granuleBias(info));
+}
+
 //! clears a portion of memory with an unsign
 void memset_uint(void* buffer,unsigned int colour,unsigned int size_in_bytes)
 {
@@ -78,28 +123,82 @@ TheoraVideoClip::TheoraVideoClip(TheoraDataSource* data_source,
     mEndOfFile(0),
     mRestarted(0),
 	mIteration(0),
-	mLastIteration(0)
+	mLastIteration(0),
+	mUserPriority(1),
+	mVisible(1),
+	mDeadline(0),
+	mScheduleIndex(-1)
 {
 	mAudioMutex=new TheoraMutex;
 
 	mTimer=mDefaultTimer=new TheoraTimer();
 
 	mFrameQueue=NULL;
+	mStream=NULL;
 	mAssignedWorkerThread=NULL;
+	mDestroying=0;
+	mSuspended=0;
+	mLoaded.store(false,std::memory_order_relaxed);
+	mLoadFailed.store(false,std::memory_order_relaxed);
+	mLoadCallback=NULL;
+	mLoadCallbackData=NULL;
+	mOutputBufferCallback=NULL;
+	mOutputBufferCallbackData=NULL;
+	mWidth=mHeight=0;
+	mNumFrames=0;
+	mStripeFrame=NULL;
+	mStripeRows=0;
+	mPrevFrameTime=-1;
+	mDataOffset=0;
 	mNumPrecachedFrames=nPrecachedFrames;
 
-	mInfo=new TheoraInfoStruct;
+	mDemuxMutex=new TheoraMutex;
+	mPacketMutex=new TheoraMutex;
+	mOutputBufferMutex=new TheoraMutex;
+	mDemuxThread=NULL;
+	mDemuxEOF=0;
+	mNumPrecachedPackets=32;
+	mSeekIndex=new TheoraSeekIndex;
+	mReadChunkSize=TH_MIN_READ_CHUNK_SIZE;
+	mUserReadChunkSize=0;
+	mScanSeekIndex=0;
+	mLoopCache=new TheoraLoopCache;
+	mLoopCacheBudget=0;
+	mLoopCached=0;
+	mLoopCacheFrame=0;
+	mPPLevel=mUserPPLevel=mMaxPPLevel=0;
+	mAdaptivePP=0;
+	mDecodeTime=-1;
+	mPPFrames=0;
+	mNumLateFrames=mPPLateFrames=0;
+	mDirtyTileTracking=0;
+	mLastFrame=NULL;
+	mFrameSerial=0;
+	mNumDecoderStalls=mNumDuplicateFrames=0;
+	mNumOccupancySamples=0;
+	mPacketOccupancySum=mFrameOccupancySum=0;
 
-	load(data_source);
+	mInfo=new TheoraInfoStruct;
+	// loaded by TheoraVideoManager, either right away or on a worker thread
+	mStream=data_source;
 }
 
 TheoraVideoClip::~TheoraVideoClip()
 {
-	// wait untill a worker thread is done decoding the frame
-	while (mAssignedWorkerThread)
+	// wait untill worker threads are done decoding the frame and demuxing
+	while (mAssignedWorkerThread || mDemuxThread)
 	{
 		_psleep(1);
 	}
+	_clearPackets();
+	foreach(TheoraVideoClipView*,mViews)
+		delete (*it);
+	mViews.clear();
+	delete mDemuxMutex;
+	delete mPacketMutex;
+	delete mOutputBufferMutex;
+	delete mSeekIndex;
+	delete mLoopCache;
 
 	delete mDefaultTimer;
 
@@ -141,32 +240,219 @@ void TheoraVideoClip::setTimer(TheoraTimer* timer)
 {
 	if (!timer) mTimer=mDefaultTimer;
 	else mTimer=timer;
+	TheoraVideoManager::getSingleton()._signalWork(this);
+}
+
+int TheoraVideoClip::getNumQueuedPackets()
+{
+	mPacketMutex->lock();
+	int n=mInfo->Packets.size();
+	mPacketMutex->unlock();
+	return n;
+}
+
+int TheoraVideoClip::getNumPrecachedPackets()
+{
+	return mNumPrecachedPackets;
+}
+
+void TheoraVideoClip::setNumPrecachedPackets(int n)
+{
+	mNumPrecachedPackets=(n > 1) ? n : 1;
+}
+
+float TheoraVideoClip::getAveragePacketQueueOccupancy()
+{
+	return mNumOccupancySamples ? (float) (mPacketOccupancySum/mNumOccupancySamples) : 0;
+}
+
+float TheoraVideoClip::getAverageFrameQueueOccupancy()
+{
+	return mNumOccupancySamples ? (float) (mFrameOccupancySum/mNumOccupancySamples) : 0;
+}
+
+void TheoraVideoClip::_queuePacket(void* packet)
+{
+	ogg_packet p=*(ogg_packet*) packet;
+	if (p.packet) // empty packets (dropped frames) still get a buffer, only restart markers have none
+	{
+		p.packet=new unsigned char[p.bytes > 0 ? p.bytes : 1];
+		memcpy(p.packet,((ogg_packet*) packet)->packet,p.bytes);
+	}
+	mPacketMutex->lock();
+	mInfo->Packets.push_back(p);
+	mPacketMutex->unlock();
+}
+
+bool TheoraVideoClip::_popPacket(void* packet)
+{
+	mPacketMutex->lock();
+	bool ret=!mInfo->Packets.empty();
+	if (ret)
+	{
+		*(ogg_packet*) packet=mInfo->Packets.front();
+		mInfo->Packets.pop_front();
+	}
+	int n=mInfo->Packets.size();
+	mPacketMutex->unlock();
+	// running low on packets, let an idle worker thread demux ahead
+	if (ret && n == mNumPrecachedPackets/2) TheoraVideoManager::getSingleton()._signalWork();
+	return ret;
+}
+
+void TheoraVideoClip::_clearPackets()
+{
+	mPacketMutex->lock();
+	for (std::deque<ogg_packet>::iterator it=mInfo->Packets.begin();it != mInfo->Packets.end();it++)
+		if (it->packet) delete [] it->packet;
+	mInfo->Packets.clear();
+	mPacketMutex->unlock();
+}
+
+bool TheoraVideoClip::_needsDemux()
+{
+	if (mDestroying || !isLoaded()) return 0;
+	if (mScanSeekIndex) return 1;
+	return !mLoopCached && !mDemuxEOF && !mEndOfFile && mSeekPos < 0 &&
+	       getNumQueuedPackets() < mNumPrecachedPackets/2+1;
+}
+
+void TheoraVideoClip::_demuxAhead()
+{
+	// the lock is released after each read, so the decoder never waits for more than one
+	for (;;)
+	{
+		mDemuxMutex->lock();
+		bool more=!mLoopCached && !mDemuxEOF && mSeekPos < 0 && getNumQueuedPackets() < mNumPrecachedPackets && _readData();
+		mDemuxMutex->unlock();
+		if (!more) break;
+	}
+	// scan a chunk at a time, so the thread can get back to decoding soon
+	if (mScanSeekIndex) _scanSeekIndex();
+}
+
+void TheoraVideoClip::_indexPage(void* page,unsigned long offset)
+{
+	ogg_page* p=(ogg_page*) page;
+	ogg_int64_t granule=ogg_page_granulepos(p);
+	long frame=-1,keyframe=-1;
+	// header pages have a granule position of 0, as does the first frame of old streams
+	if (ogg_page_serialno(p) == mInfo->TheoraStreamState.serialno && granule > 0)
+	{
+		int shift=mInfo->TheoraInfo.keyframe_granule_shift;
+		frame=_granuleFrame(&mInfo->TheoraInfo,granule);
+		keyframe=_granuleFrame(&mInfo->TheoraInfo,(granule >> shift) << shift);
+	}
+	mSeekIndex->addPage(offset,p->header_len+p->body_len,granule,frame,keyframe);
+}
+
+void TheoraVideoClip::_scanSeekIndex()
+{
+	ogg_sync_state sync;
+	ogg_page page;
+	ogg_sync_init(&sync);
+
+	mDemuxMutex->lock();
+	// continue where the index ends, the scan shares the data source with the demuxer
+	unsigned long pos=mStream->tell(),offset=mSeekIndex->getEnd();
+	mStream->seek(offset);
+	char* buffer=ogg_sync_buffer(&sync,TH_SEEK_INDEX_SCAN_CHUNK);
+	int bytesRead=mStream->read(buffer,TH_SEEK_INDEX_SCAN_CHUNK);
+	ogg_sync_wrote(&sync,bytesRead);
+	mStream->seek(pos);
+
+	int nPages=0;
+	while (ogg_sync_pageout(&sync,&page) > 0)
+	{
+		_indexPage(&page,offset+bytesRead-(sync.fill-sync.returned)-(page.header_len+page.body_len));
+		nPages++;
+	}
+	// stop at the end of the file, or if the index can't grow (eg. trailing garbage)
+	if (_isSeekIndexComplete() || nPages == 0)
+	{
+		mScanSeekIndex=0;
+		th_writelog(mName+": seek index "+(_isSeekIndexComplete() ? "complete, " : "incomplete, ")+
+		            str(mSeekIndex->getNumEntries())+" pages");
+	}
+	mDemuxMutex->unlock();
+	ogg_sync_clear(&sync);
+}
+
+bool TheoraVideoClip::_isSeekIndexComplete()
+{
+	return !mSeekIndex->isEmpty() && mSeekIndex->getEnd() >= mStream->size();
+}
+
+void TheoraVideoClip::scanSeekIndex()
+{
+	mDemuxMutex->lock();
+	mScanSeekIndex=!_isSeekIndexComplete();
+	mDemuxMutex->unlock();
+	if (mScanSeekIndex) TheoraVideoManager::getSingleton()._signalWork();
+}
+
+bool TheoraVideoClip::isSeekIndexComplete()
+{
+	mDemuxMutex->lock();
+	bool ret=_isSeekIndexComplete();
+	mDemuxMutex->unlock();
+	return ret;
+}
+
+bool TheoraVideoClip::saveSeekIndex(std::string filename)
+{
+	mDemuxMutex->lock();
+	bool ret=mSeekIndex->save(filename,mStream->size(),mInfo->TheoraStreamState.serialno);
+	mDemuxMutex->unlock();
+	if (!ret) th_writelog(mName+": unable to save seek index to "+filename);
+	return ret;
+}
+
+bool TheoraVideoClip::loadSeekIndex(std::string filename)
+{
+	mDemuxMutex->lock();
+	bool ret=mSeekIndex->load(filename,mStream->size(),mInfo->TheoraStreamState.serialno);
+	if (ret && _isSeekIndexComplete()) mScanSeekIndex=0;
+	mDemuxMutex->unlock();
+	if (ret) th_writelog(mName+": loaded seek index from "+filename);
+	return ret;
 }
 
 bool TheoraVideoClip::_readData()
 {
-	int audio_eos=0;
+	int audio_eos=0,chunkSize=getReadChunkSize();
 	float audio_time=0;
 	float time=mTimer->getTime();
 	if (mRestarted) time=0;
 
 	for (;;)
 	{
-		char *buffer = ogg_sync_buffer( &mInfo->OggSyncState, 4096);
-		int bytesRead = mStream->read( buffer, 4096 );
+		char *buffer = ogg_sync_buffer( &mInfo->OggSyncState, chunkSize);
+		int bytesRead = mStream->read( buffer, chunkSize );
 		ogg_sync_wrote(&mInfo->OggSyncState, bytesRead);
 
-		if (bytesRead < 4096)
+		if (bytesRead < chunkSize)
 		{
 			if (bytesRead == 0)
 			{
-				if (mAutoRestart) _restart();
-				else mEndOfFile=true;
+				if (mAutoRestart)
+				{
+					_restartDemuxer();
+					// tell the decoder to restart once it gets to this point
+					ogg_packet marker;
+					memset(&marker,0,sizeof(marker));
+					_queuePacket(&marker);
+				}
+				else mDemuxEOF=true;
 				return 0;
 			}
 		}
 		while ( ogg_sync_pageout( &mInfo->OggSyncState, &mInfo->OggPage ) > 0 )
 		{
+			// the page ends where the bytes that are still buffered in the sync state begin
+			ogg_sync_state* sync=&mInfo->OggSyncState;
+			_indexPage(&mInfo->OggPage,mStream->tell()-(sync->fill-sync->returned)-
+			                           (mInfo->OggPage.header_len+mInfo->OggPage.body_len));
 			ogg_stream_pagein(&mInfo->TheoraStreamState,&mInfo->OggPage);
 			if (mAudioInterface &&
 				ogg_page_serialno(&mInfo->OggPage) == mInfo->VorbisStreamState.serialno)
@@ -189,39 +475,106 @@ bool TheoraVideoClip::_readData()
 		if (!(mAudioInterface && !audio_eos && audio_time < time+1.0f))
 			break;
 	}
+	// move complete theora packets to the decoder's queue
+	ogg_packet op;
+	int ret;
+	while ((ret=ogg_stream_packetout(&mInfo->TheoraStreamState,&op)) != 0)
+		if (ret > 0) _queuePacket(&op);
 	return 1;
 }
 
+void _theoraStripeDecoded(void* ctx,th_ycbcr_buffer buff,int yfrag0,int yfrag_end)
+{
+	((TheoraVideoClip*) ctx)->_decodeStripe(buff,yfrag0,yfrag_end);
+}
+
+void TheoraVideoClip::_decodeStripe(void* yuv,int yfrag0,int yfrag_end)
+{
+	if (!mStripeFrame) return;
+	// fragment rows are 8 luma pixels high
+	int y0=yfrag0*8,y1=yfrag_end*8;
+	if (y1 > mHeight) y1=mHeight;
+	mStripeFrame->decodeRows(yuv,y0,y1);
+	mStripeFrame->_updateDirtyTiles(y0,y1); // compare while the rows are still in cache
+	mStripeRows+=y1-y0;
+}
+
 void TheoraVideoClip::decodeNextFrame()
 {
 	if (mEndOfFile) return;
 
 	TheoraVideoFrame* frame=mFrameQueue->requestEmptyFrame();
 	if (!frame) return; // max number of precached frames reached
+	_attachOutputBuffer(frame);
+	if (mLoopCached)
+	{
+		_replayFrame(frame);
+		return;
+	}
 	long nSeekSkippedFrames=0;
 	ogg_packet opTheora;
 	ogg_int64_t granulePos;
 	th_ycbcr_buffer buff;
+	th_stripe_callback stripe_cb;
+	float frameDuration=(float) mInfo->TheoraInfo.fps_denominator/mInfo->TheoraInfo.fps_numerator;
+	// convert rows from the decoder's stripe callback while they're still in cache. frames
+	// that get split into bands for other worker threads are converted after decoding
+	bool stripes=_getNumPlanes(mOutputMode) == 1 && _getNumConversionBands(mOutputMode,mHeight) == 1;
 
 	//writelog("Decoding video "+mName);
 
 	for(;;)
 	{
-		int ret=ogg_stream_packetout(&mInfo->TheoraStreamState,&opTheora);
-
-		if (ret > 0)
+		if (_popPacket(&opTheora))
 		{
-
+			if (!opTheora.packet) // the demuxer reached the end and restarted the stream
+			{
+				_restartDecoder();
+				if (mLoopCacheBudget > 0 && mLoopCache->isComplete())
+				{
+					// the whole pass is cached, packets of the next loop aren't needed anymore
+					mLoopCached=1;
+					mLoopCacheFrame=0;
+					_clearPackets();
+					th_writelog(mName+": cached "+str(mLoopCache->getNumFrames())+" frames ("+
+					            str(mLoopCache->getSize()/1024)+" KB), replaying loops from memory");
+				}
+				mStripeFrame=NULL;
+				frame->mInUse=0;
+				return;
+			}
 			if (mSeekPos == -2) // searching for next keyframe
 			{
 				int keyframe=th_packet_iskeyframe(&opTheora);
-				if (!keyframe) { nSeekSkippedFrames++; continue; }
+				if (!keyframe) { delete [] opTheora.packet; nSeekSkippedFrames++; continue; }
 				mSeekPos=-1;
 				if (nSeekSkippedFrames > 0)
 					th_writelog(mName+"[seek]: skipped "+str(nSeekSkippedFrames)+" frames while searching for keyframe");
 			}
-			if (th_decode_packetin(mInfo->TheoraDecoder, &opTheora,&granulePos ) != 0) continue; // 0 means success
+			// don't waste time converting stripes of frames that will probably be dropped
+			mStripeFrame=(stripes && mPrevFrameTime >= 0 &&
+			              (mRestarted || mPrevFrameTime+frameDuration >= mTimer->getTime())) ? frame : NULL;
+			mStripeRows=0;
+			stripe_cb.ctx=this;
+			stripe_cb.stripe_decoded=mStripeFrame ? _theoraStripeDecoded : NULL;
+			th_decode_ctl(mInfo->TheoraDecoder,TH_DECCTL_SET_STRIPE_CB,&stripe_cb,sizeof(stripe_cb));
+			th_decode_ctl(mInfo->TheoraDecoder,TH_DECCTL_SET_PPLEVEL,&mPPLevel,sizeof(mPPLevel));
+			frame->_beginDirtyTiles(_getDirtyReference(frame));
+
+			double decodeStart=_getTime();
+			int ret=th_decode_packetin(mInfo->TheoraDecoder, &opTheora,&granulePos );
+			delete [] opTheora.packet;
+			if (ret == TH_DUPFRAME)
+			{
+				// same picture as the previous frame, nothing to convert or upload
+				mNumDuplicateFrames++;
+				mPrevFrameTime=(float) th_granule_time(mInfo->TheoraDecoder,granulePos);
+				mLoopCache->addDuplicate((unsigned long) th_granule_frame(mInfo->TheoraDecoder,granulePos));
+				continue;
+			}
+			if (ret != 0) continue; // 0 means success
 			float time=(float) th_granule_time(mInfo->TheoraDecoder,granulePos);
+			mPrevFrameTime=time;
 			unsigned long frame_number=(unsigned long) th_granule_frame(mInfo->TheoraDecoder,granulePos);
 			if (time > mDuration)
 				mDuration=time; // duration corrections
@@ -234,20 +587,48 @@ void TheoraVideoClip::decodeNextFrame()
 #endif
 				mNumDisplayedFrames++;
 				mNumDroppedFrames++;
+				mLoopCache->clear(); // this pass can't be cached anymore
 				continue; // drop frame
 			}
 			frame->mTimeToDisplay=time;
 			frame->mIteration=mIteration;
 			frame->_setFrameNumber(frame_number);
-			th_decode_ycbcr_out(mInfo->TheoraDecoder,buff);
-			frame->decode(buff);
+			if (mStripeFrame && mStripeRows >= mHeight)
+				frame->mReady=true; // already converted by the stripe callback
+			else
+			{
+				th_decode_ycbcr_out(mInfo->TheoraDecoder,buff);
+				frame->decode(buff);
+				frame->_updateDirtyTiles(0,mHeight);
+			}
+			mStripeFrame=NULL;
+			_updatePostProcessing((float) (_getTime()-decodeStart));
+			if (mLoopCacheBudget > 0 && mAutoRestart && !mAudioInterface)
+			{
+				if (!mLoopCache->add(frame_number,time,frame,mLoopCacheBudget))
+					th_writelog(mName+": loop cache budget exceeded, decoding every loop");
+			}
+			else if (mLoopCache->getSize() > 0) mLoopCache->clear();
+			_pushFrame(frame);
+
+			mNumOccupancySamples++;
+			mPacketOccupancySum+=getNumQueuedPackets();
+			mFrameOccupancySum+=mFrameQueue->getReadyCount();
 			//_psleep(rand()%20); // temp
 			break;
 		}
 		else
 		{
-			if (!_readData())
+			// the packet queue ran dry, demux in this thread. if another thread is
+			// demuxing ahead, this waits until it's done with the current read
+			mNumDecoderStalls++;
+			mDemuxMutex->lock();
+			bool more=getNumQueuedPackets() > 0 || _readData();
+			mDemuxMutex->unlock();
+			if (!more && getNumQueuedPackets() == 0)
 			{
+				if (mDemuxEOF) mEndOfFile=true;
+				mStripeFrame=NULL;
 				frame->mInUse=0;
 				return;
 			}
@@ -255,12 +636,182 @@ void TheoraVideoClip::decodeNextFrame()
 	}
 }
 
+void TheoraVideoClip::_replayFrame(TheoraVideoFrame* frame)
+{
+	TheoraLoopCache::Entry* entry;
+	for (;;)
+	{
+		if (mLoopCacheFrame >= mLoopCache->getNumFrames())
+		{
+			if (!mAutoRestart)
+			{
+				mEndOfFile=true;
+				frame->mInUse=0;
+				return;
+			}
+			if (mLoopCache->getSize() > (unsigned long) mLoopCacheBudget || mAudioInterface)
+			{
+				// the budget was lowered, decode from the start of the file again
+				mLoopCached=0;
+				mLoopCache->clear();
+				mDemuxMutex->lock();
+				_restart();
+				mDemuxMutex->unlock();
+				th_writelog(mName+": loop cache released, decoding every loop");
+				frame->mInUse=0;
+				return;
+			}
+			// start the next loop the same way the decoder does when it restarts
+			mLoopCacheFrame=0;
+			mPrevFrameTime=-1;
+			mRestarted=1;
+		}
+		entry=mLoopCache->getFrame(mLoopCacheFrame++);
+		if (entry->time < mTimer->getTime() && !mRestarted)
+		{
+			mNumDisplayedFrames++;
+			mNumDroppedFrames++;
+			continue; // drop frame
+		}
+		break;
+	}
+	frame->_beginDirtyTiles(_getDirtyReference(frame));
+	frame->_copyFrom(entry->data);
+	frame->_updateDirtyTiles(0,mHeight);
+	frame->mTimeToDisplay=entry->time;
+	frame->mIteration=mIteration;
+	frame->_setFrameNumber(entry->frame);
+	frame->mReady=true;
+	mPrevFrameTime=entry->time;
+	_pushFrame(frame);
+}
+
+TheoraVideoFrame* TheoraVideoClip::_getDirtyReference(TheoraVideoFrame* frame)
+{
+	// a frame queue of one frame reuses the buffer of the last frame
+	return (mDirtyTileTracking && mLastFrame != frame) ? mLastFrame : NULL;
+}
+
+void TheoraVideoClip::_attachOutputBuffer(TheoraVideoFrame* frame)
+{
+	// a frame that was discarded before the application got it keeps its buffer
+	if (frame->hasExternalBuffer()) return;
+	mOutputBufferMutex->lock();
+	if (!mInfo->OutputBuffers.empty())
+	{
+		frame->_setOutputBuffer(mInfo->OutputBuffers.front().first,mInfo->OutputBuffers.front().second);
+		mInfo->OutputBuffers.pop_front();
+	}
+	else frame->_setOutputBuffer(NULL,0);
+	mOutputBufferMutex->unlock();
+}
+
+void TheoraVideoClip::_requeueOutputBuffer(TheoraVideoFrame* frame)
+{
+	mOutputBufferMutex->lock();
+	mInfo->OutputBuffers.push_front(std::make_pair(frame->getBuffer(),frame->getStride()));
+	mOutputBufferMutex->unlock();
+	frame->_detachOutputBuffer();
+}
+
+void TheoraVideoClip::_clearOutputBuffers()
+{
+	std::deque<std::pair<unsigned char*,int> > buffers;
+	mOutputBufferMutex->lock();
+	buffers.swap(mInfo->OutputBuffers);
+	mOutputBufferMutex->unlock();
+	// without the lock, the callback may add buffers again
+	if (mOutputBufferCallback)
+		for (std::deque<std::pair<unsigned char*,int> >::iterator it=buffers.begin();it != buffers.end();it++)
+			mOutputBufferCallback(this,it->first,mOutputBufferCallbackData);
+}
+
+void TheoraVideoClip::_releaseOutputBuffer(TheoraVideoFrame* frame)
+{
+	unsigned char* buffer=frame->getBuffer();
+	frame->_detachOutputBuffer();
+	if (mOutputBufferCallback) mOutputBufferCallback(this,buffer,mOutputBufferCallbackData);
+}
+
+void TheoraVideoClip::setOutputBufferCallback(TheoraOutputBufferCallback callback,void* user_data)
+{
+	mOutputBufferCallback=callback;
+	mOutputBufferCallbackData=user_data;
+}
+
+bool TheoraVideoClip::addOutputBuffer(unsigned char* buffer,int pitch)
+{
+	int bpp=_getBytesPerPixel(mOutputMode),stride=pitch/bpp;
+	// chroma rows of planar modes are half a luma row
+	if (!buffer || pitch % bpp != 0 || stride < mWidth || (_getNumPlanes(mOutputMode) > 1 && stride % 2 != 0))
+	{
+		th_writelog(mName+": invalid output buffer pitch "+str(pitch));
+		return 0;
+	}
+	mOutputBufferMutex->lock();
+	mInfo->OutputBuffers.push_back(std::make_pair(buffer,stride));
+	mOutputBufferMutex->unlock();
+	TheoraVideoManager::getSingleton()._signalWork(this);
+	return 1;
+}
+
+int TheoraVideoClip::getNumOutputBuffers()
+{
+	mOutputBufferMutex->lock();
+	int n=mInfo->OutputBuffers.size();
+	mOutputBufferMutex->unlock();
+	return n;
+}
+
+void TheoraVideoClip::clearOutputBuffers()
+{
+	TheoraVideoManager& mgr=TheoraVideoManager::getSingleton();
+	// no worker thread may decode into or schedule the clip while the frames are recreated
+	mgr._suspendClip(this);
+	_clearOutputBuffers();
+	// recreating the frames gives back the buffers of frames that weren't displayed yet
+	mLastFrame=NULL;
+	mFrameQueue->reset();
+	mgr._resumeClip(this);
+}
+
+void TheoraVideoClip::_pushFrame(TheoraVideoFrame* frame)
+{
+	frame->_setSerial(++mFrameSerial);
+	// an application buffer is handed back once the frame is popped, it can't be compared against later
+	mLastFrame=frame->hasExternalBuffer() ? NULL : frame;
+	mFrameQueue->push(frame);
+}
+
 void TheoraVideoClip::_restart()
 {
-	long granule=0;
-	th_decode_ctl(mInfo->TheoraDecoder,TH_DECCTL_SET_GRANPOS,&granule,sizeof(granule));
-	th_decode_free(mInfo->TheoraDecoder);
-	mInfo->TheoraDecoder=th_decode_alloc(&mInfo->TheoraInfo,mInfo->TheoraSetup);
+	_restartDemuxer();
+	_clearPackets();
+	_restartDecoder();
+	mEndOfFile=false;
+}
+
+void TheoraVideoClip::_restartDecoder()
+{
+	// the first frame is a keyframe, so the decoder only needs its frame count reset.
+	// granule positions of streams older than 3.2.1 can't express the frame before
+	// the first one, those decoders are recreated instead
+	if (_granuleBias(&mInfo->TheoraInfo))
+	{
+		ogg_int64_t granule=0;
+		th_decode_ctl(mInfo->TheoraDecoder,TH_DECCTL_SET_GRANPOS,&granule,sizeof(granule));
+	}
+	else
+	{
+		th_decode_free(mInfo->TheoraDecoder);
+		mInfo->TheoraDecoder=th_decode_alloc(&mInfo->TheoraInfo,mInfo->TheoraSetup);
+	}
+	mPrevFrameTime=-1;
+	mRestarted=1;
+}
+
+void TheoraVideoClip::_restartDemuxer()
+{
 	ogg_stream_reset(&mInfo->TheoraStreamState);
 	if (mAudioInterface)
 	{
@@ -277,12 +828,11 @@ void TheoraVideoClip::_restart()
 		ogg_stream_reset(&mInfo->VorbisStreamState);
 	}
 
+	// the headers were parsed when the clip was loaded, skip them
 	ogg_sync_reset(&mInfo->OggSyncState);
-	mStream->seek(0);
+	mStream->seek(mDataOffset);
 	//mTimer->seek(0);
-	mEndOfFile=false;
-
-	mRestarted=1;
+	mDemuxEOF=false;
 }
 
 void TheoraVideoClip::restart()
@@ -290,13 +840,17 @@ void TheoraVideoClip::restart()
 	bool end=mEndOfFile;
 	mEndOfFile=1; //temp, to prevent threads to decode while restarting
 	while (mAssignedWorkerThread) _psleep(1); // wait for assigned thread to do it's work
+	mDemuxMutex->lock();
 	_restart();
+	mDemuxMutex->unlock();
 	mTimer->seek(0);
 	mFrameQueue->clear();
+	mLoopCacheFrame=0;
 	mEndOfFile=0;
 	mIteration=0;
 	mRestarted=0;
 	mSeekPos=-1;
+	TheoraVideoManager::getSingleton()._signalWork(this);
 }
 
 void TheoraVideoClip::update(float time_increase)
@@ -329,7 +883,7 @@ void TheoraVideoClip::update(float time_increase)
 				}
 				else break;
 			}
-			if (n > 0) th_writelog("dropped "+str(n)+" end frames");
+			if (n > 1) th_writelog(mName+": dropped "+str(n-1)+" end frames");
 		}
 		else return;
 	}
@@ -350,11 +904,13 @@ void TheoraVideoClip::popFrame()
 	mNumDisplayedFrames++;
 	mFrameQueue->pop(); // after transfering frame data to the texture, free the frame
 						// so it can be used again
+	TheoraVideoManager::getSingleton()._signalWork(this);
 }
 
 TheoraVideoFrame* TheoraVideoClip::getNextFrame()
 {
 	TheoraVideoFrame* frame;
+	if (!isLoaded()) return 0;
 	float time=mTimer->getTime();
 	for (;;)
 	{
@@ -368,8 +924,10 @@ TheoraVideoFrame* TheoraVideoClip::getNextFrame()
 			th_writelog(mName+": dropped frame "+str(frame->getFrameNumber()));
 #endif
 			mNumDroppedFrames++;
+			mNumLateFrames++;
 			mNumDisplayedFrames++;
 			mFrameQueue->pop();
+			TheoraVideoManager::getSingleton()._signalWork(this);
 		}
 		else break;
 	}
@@ -428,6 +986,8 @@ void TheoraVideoClip::load(TheoraDataSource* source)
 
 	mInfo->TheoraDecoder=th_decode_alloc(&mInfo->TheoraInfo,mInfo->TheoraSetup);
 
+	th_decode_ctl(mInfo->TheoraDecoder,TH_DECCTL_GET_PPLEVEL_MAX,&mMaxPPLevel,sizeof(mMaxPPLevel));
+
 	mWidth=mInfo->TheoraInfo.frame_width;
 	mHeight=mInfo->TheoraInfo.frame_height;
 	mStride=(mStride == 1) ? mStride=_nextPow2(mWidth) : mWidth;
@@ -435,55 +995,109 @@ void TheoraVideoClip::load(TheoraDataSource* source)
 	mFrameQueue=new TheoraFrameQueue(mNumPrecachedFrames,this);
 
 
-	// find out the duration of the file by seeking to the end
-	// having ogg decode pages, extract the granule pos from
-	// the last theora page and seek back to beginning of the file
-	for (int i=1;i<=10;i++)
+	readDuration();
+	_updateReadChunkSize();
+
+	if (mVorbisStreams) // if there is no audio interface factory defined, even though the video
+		                // clip might have audio, it will be ignored
 	{
-		ogg_sync_reset(&mInfo->OggSyncState);
-		mStream->seek(mStream->size()-4096*i);
+		vorbis_synthesis_init(&mInfo->VorbisDSPState,&mInfo->VorbisInfo);
+		vorbis_block_init(&mInfo->VorbisDSPState,&mInfo->VorbisBlock);
+		// create an audio interface instance if available
+		TheoraAudioInterfaceFactory* audio_factory=TheoraVideoManager::getSingleton().getAudioInterfaceFactory();
+		if (audio_factory) setAudioInterface(audio_factory->createInstance(this,mInfo->VorbisInfo.channels,mInfo->VorbisInfo.rate));
+	}
+	// release: everything set up above becomes visible to threads that see the clip as loaded
+	mLoaded.store(true,std::memory_order_release);
+}
 
-		char *buffer = ogg_sync_buffer(&mInfo->OggSyncState, 4096*i);
-		int bytesRead = mStream->read(buffer, 4096*i);
-		ogg_sync_wrote(&mInfo->OggSyncState, bytesRead );
-		ogg_sync_pageseek(&mInfo->OggSyncState,&mInfo->OggPage);
+void TheoraVideoClip::_loadAsync()
+{
+	try
+	{
+		load(mStream);
+	}
+	catch (_TheoraGenericException& e)
+	{
+		th_writelog(mName+": unable to load clip: "+e.getErrorText());
+		mLoadFailed.store(true,std::memory_order_release);
+	}
+}
 
-		while (1)
+void TheoraVideoClip::readDuration()
+{
+	// find out the duration of the file by walking backwards from its end until
+	// a theora page with a granule pos is found. this uses its own sync state, so the
+	// demuxer carries on right after the headers and they don't have to be parsed again
+	ogg_sync_state sync;
+	ogg_page page;
+	ogg_int64_t granule=-1;
+	unsigned long pos=mStream->tell(),size=mStream->size(),start=size,end;
+	int ret;
+	ogg_sync_init(&sync);
+
+	while (granule < 0 && start > 0)
+	{
+		// a file with a long tail without video (or garbage at the end) would otherwise be
+		// read all the way back to its start
+		if (size-start >= TH_DURATION_SCAN_MAX)
+		{
+			th_writelog(mName+": no theora page in the last "+str(TH_DURATION_SCAN_MAX/1024)+" KB, unknown duration");
+			break;
+		}
+		// windows overlap by a maximum page size so pages on the boundary are found whole
+		end=(start+TH_MAX_PAGE_SIZE < size) ? start+TH_MAX_PAGE_SIZE : size;
+		start=(end > TH_DURATION_SCAN_WINDOW) ? end-TH_DURATION_SCAN_WINDOW : 0;
+		ogg_sync_reset(&sync);
+		mStream->seek(start);
+		char *buffer = ogg_sync_buffer(&sync,end-start);
+		int bytesRead = mStream->read(buffer,end-start);
+		ogg_sync_wrote(&sync,bytesRead);
+		// windows usually start in the middle of a page, -1 reports the bytes skipped before the first one
+		while ((ret=ogg_sync_pageout(&sync,&page)) != 0)
 		{
-			int ret=ogg_sync_pageout( &mInfo->OggSyncState, &mInfo->OggPage );
-			if (ret == 0) break;
 			// if page is not a theora page, skip it
-			if (ogg_page_serialno(&mInfo->OggPage) != mInfo->TheoraStreamState.serialno) continue;
-
-			unsigned long granule=(unsigned long) ogg_page_granulepos(&mInfo->OggPage);
-			if (granule >= 0)
-			{
-				mDuration=(float) th_granule_time(mInfo->TheoraDecoder,granule);
-				mNumFrames=(unsigned long) th_granule_frame(mInfo->TheoraDecoder,granule)+1;
-			}
+			if (ret < 0 || ogg_page_serialno(&page) != mInfo->TheoraStreamState.serialno) continue;
+			if (ogg_page_granulepos(&page) >= 0) granule=ogg_page_granulepos(&page);
 		}
-		if (mDuration > 0) break;
+	}
+	ogg_sync_clear(&sync);
+	mStream->seek(pos);
 
+	if (granule >= 0)
+	{
+		mDuration=(float) th_granule_time(mInfo->TheoraDecoder,granule);
+		mNumFrames=(unsigned long) th_granule_frame(mInfo->TheoraDecoder,granule)+1;
 	}
 	if (mDuration < 0)
 		th_writelog(mName+": unable to determine file duration!");
 	else
 		th_writelog(mName+": file duration is "+strf(mDuration)+" seconds");
-	// restore to beginning of stream.
-	ogg_sync_reset(&mInfo->OggSyncState);
-	mStream->seek(0);
-	mTheoraStreams=mVorbisStreams=0;
-	readTheoraVorbisHeaders();
+}
 
-	if (mVorbisStreams) // if there is no audio interface factory defined, even though the video
-		                // clip might have audio, it will be ignored
-	{
-		vorbis_synthesis_init(&mInfo->VorbisDSPState,&mInfo->VorbisInfo);
-		vorbis_block_init(&mInfo->VorbisDSPState,&mInfo->VorbisBlock);
-		// create an audio interface instance if available
-		TheoraAudioInterfaceFactory* audio_factory=TheoraVideoManager::getSingleton().getAudioInterfaceFactory();
-		if (audio_factory) setAudioInterface(audio_factory->createInstance(this,mInfo->VorbisInfo.channels,mInfo->VorbisInfo.rate));
-	}
+void TheoraVideoClip::_updateReadChunkSize()
+{
+	// aim for about one read per frame. the average data rate includes audio and
+	// container overhead, the encoder's target bitrate is used if the duration is unknown
+	float fps=(float) mInfo->TheoraInfo.fps_numerator/mInfo->TheoraInfo.fps_denominator,bytes_per_second=0;
+	if (mDuration > 0) bytes_per_second=mStream->size()/mDuration;
+	else               bytes_per_second=mInfo->TheoraInfo.target_bitrate/8.0f;
+	int size=(fps > 0) ? _nextPow2((int) (bytes_per_second/fps)) : 0;
+	if (size < TH_MIN_READ_CHUNK_SIZE) size=TH_MIN_READ_CHUNK_SIZE;
+	if (size > TH_MAX_READ_CHUNK_SIZE) size=TH_MAX_READ_CHUNK_SIZE;
+	mReadChunkSize=size;
+	if (mUserReadChunkSize == 0) th_writelog(mName+": read chunk size is "+str(mReadChunkSize)+" bytes");
+}
+
+void TheoraVideoClip::setReadChunkSize(int size)
+{
+	// the override is picked up by the next read, the automatic size is kept in case it's removed
+	mUserReadChunkSize=(size > 0) ? size : 0;
+}
+
+int TheoraVideoClip::getReadChunkSize()
+{
+	return (mUserReadChunkSize > 0) ? mUserReadChunkSize : mReadChunkSize;
 }
 
 void TheoraVideoClip::readTheoraVorbisHeaders()
@@ -512,8 +1126,8 @@ void TheoraVideoClip::readTheoraVorbisHeaders()
 
 	while (!done)
 	{
-		char *buffer = ogg_sync_buffer( &mInfo->OggSyncState, 4096);
-		int bytesRead = mStream->read( buffer, 4096 );
+		char *buffer = ogg_sync_buffer( &mInfo->OggSyncState, TH_MIN_READ_CHUNK_SIZE);
+		int bytesRead = mStream->read( buffer, TH_MIN_READ_CHUNK_SIZE );
 		ogg_sync_wrote( &mInfo->OggSyncState, bytesRead );
 
 		if( bytesRead == 0 )
@@ -609,14 +1223,17 @@ void TheoraVideoClip::readTheoraVorbisHeaders()
 		}
 		else
 		{
-			char *buffer = ogg_sync_buffer( &mInfo->OggSyncState, 4096);
-			int bytesRead = mStream->read( buffer, 4096 );
+			char *buffer = ogg_sync_buffer( &mInfo->OggSyncState, TH_MIN_READ_CHUNK_SIZE);
+			int bytesRead = mStream->read( buffer, TH_MIN_READ_CHUNK_SIZE );
 			ogg_sync_wrote( &mInfo->OggSyncState, bytesRead );
 
 			if( bytesRead == 0 )
 				throw TheoraGenericException("End of file found prematurely");
 		}
 	} //end while looking for all headers
+	// header packets end their pages and come before any data pages, so the first data
+	// page starts where the bytes that are still buffered in the sync state begin
+	mDataOffset=mStream->tell()-(mInfo->OggSyncState.fill-mInfo->OggSyncState.returned);
 //	writelog("Vorbis Headers: " + str(mVorbisHeaders) + " Theora Headers : " + str(mTheoraHeaders));
 }
 
@@ -630,6 +1247,14 @@ bool TheoraVideoClip::isBusy()
 	return mAssignedWorkerThread || mOutputMode != mRequestedOutputMode;
 }
 
+bool TheoraVideoClip::hasWork()
+{
+	// checked first, the frame queue may be in the middle of being rebuilt while suspended
+	if (mDestroying || mSuspended || !isLoaded()) return 0;
+	if (mSeekPos >= 0) return 1;
+	return !mEndOfFile && mFrameQueue->hasEmptyFrame();
+}
+
 TheoraOutputMode TheoraVideoClip::getOutputMode()
 {
 	return mOutputMode;
@@ -638,11 +1263,23 @@ TheoraOutputMode TheoraVideoClip::getOutputMode()
 void TheoraVideoClip::setOutputMode(TheoraOutputMode mode)
 {
 	if (mOutputMode == mode) return;
+	TheoraVideoManager& mgr=TheoraVideoManager::getSingleton();
 	mRequestedOutputMode=mode;
-	while (mAssignedWorkerThread) _psleep(1);
+	mgr._suspendClip(this);
+	// cached frames are in the old format, decode from the current position again
+	if (mLoopCached)
+	{
+		mLoopCached=0;
+		mSeekPos=mTimer->getTime();
+	}
+	mLoopCache->clear();
+	// application buffers were sized for the old format
+	_clearOutputBuffers();
 	// discard current frames and recreate them
-	mFrameQueue->setSize(mFrameQueue->getSize());
+	mLastFrame=NULL;
+	mFrameQueue->reset();
 	mOutputMode=mRequestedOutputMode;
+	mgr._resumeClip(this);
 }
 
 float TheoraVideoClip::getTimePosition()
@@ -656,8 +1293,31 @@ int TheoraVideoClip::getNumPrecachedFrames()
 
 void TheoraVideoClip::setNumPrecachedFrames(int n)
 {
-	if (mFrameQueue->getSize() != n)
-		mFrameQueue->setSize(n);
+	if (mFrameQueue->getSize() == n) return;
+	TheoraVideoManager& mgr=TheoraVideoManager::getSingleton();
+	// no worker thread may decode into or schedule the clip while the queue is rebuilt
+	mgr._suspendClip(this);
+	// ready frames are kept, a free frame the next one would be compared against might not be
+	mLastFrame=NULL;
+	mFrameQueue->setSize(n);
+	mgr._resumeClip(this);
+}
+
+int TheoraVideoClip::getEffectiveNumPrecachedFrames()
+{
+	return mFrameQueue->getLimit();
+}
+
+void TheoraVideoClip::_setFrameLimit(int n)
+{
+	int prev=mFrameQueue->getLimit();
+	mFrameQueue->setLimit(n);
+	if (mFrameQueue->getLimit() > prev) TheoraVideoManager::getSingleton()._signalWork(this);
+}
+
+int TheoraVideoClip::_getFrameBufferSize()
+{
+	return mFrameQueue->getFrameBufferSize();
 }
 
 int TheoraVideoClip::getNumReadyFrames()
@@ -678,11 +1338,13 @@ int TheoraVideoClip::getFPS()
 void TheoraVideoClip::play()
 {
 	mTimer->play();
+	TheoraVideoManager::getSingleton()._signalWork(this);
 }
 
 void TheoraVideoClip::pause()
 {
 	mTimer->pause();
+	TheoraVideoManager::getSingleton()._signalWork(this); // reschedule with the paused penalty
 }
 
 bool TheoraVideoClip::isPaused()
@@ -692,7 +1354,8 @@ bool TheoraVideoClip::isPaused()
 
 bool TheoraVideoClip::isDone()
 {
-    return mEndOfFile && !mFrameQueue->getFirstAvailableFrame();
+	// duplicates at the end of the file aren't queued, the last frame is held until they're over
+	return mEndOfFile && !mFrameQueue->getFirstAvailableFrame() && mTimer->getTime() >= mPrevFrameTime;
 }
 
 void TheoraVideoClip::stop()
@@ -704,6 +1367,7 @@ void TheoraVideoClip::stop()
 void TheoraVideoClip::setPlaybackSpeed(float speed)
 {
     mTimer->setSpeed(speed);
+	TheoraVideoManager::getSingleton()._signalWork(this);
 }
 
 float TheoraVideoClip::getPlaybackSpeed()
@@ -754,8 +1418,9 @@ long TheoraVideoClip::seekPage(long targetFrame,bool return_keyframe)
 			}
 			else
 			{
-				char *buffer = ogg_sync_buffer( &mInfo->OggSyncState, 4096);
-				int bytesRead = mStream->read( buffer, 4096);
+				int chunkSize=getReadChunkSize();
+				char *buffer = ogg_sync_buffer( &mInfo->OggSyncState, chunkSize);
+				int bytesRead = mStream->read( buffer, chunkSize);
 				if (bytesRead == 0) break;
 				ogg_sync_wrote( &mInfo->OggSyncState, bytesRead );
 			}
@@ -775,18 +1440,38 @@ void TheoraVideoClip::doSeek()
 {
 	int frame,targetFrame=(int) (mNumFrames*mSeekPos/mDuration);
 
+	if (mLoopCached)
+	{
+		// every frame is in memory, seeking only moves the replay position
+		mFrameQueue->clear();
+		mLoopCacheFrame=std::min(targetFrame,mLoopCache->getNumFrames()-1);
+		mTimer->seek(((float) mLoopCacheFrame/mNumFrames)*mDuration);
+		mEndOfFile=0;
+		mRestarted=0;
+		mPrevFrameTime=-1;
+		mSeekPos=-1;
+		return;
+	}
+
+	// wait for a thread that's demuxing ahead, then keep it out until seeking is done
+	mDemuxMutex->lock();
 	if (targetFrame == 0)
 	{
 		_restart();
 		mTimer->seek(0);
 		mFrameQueue->clear();
+		mSeekPos=-1;
+		mDemuxMutex->unlock();
 		return;
 	}
 
 	mEndOfFile=0;
 	mRestarted=0;
+	mPrevFrameTime=-1;
 
 	mFrameQueue->clear();
+	_clearPackets();
+	mDemuxEOF=0;
 	ogg_stream_reset(&mInfo->TheoraStreamState);
 	th_decode_free(mInfo->TheoraDecoder);
 	mInfo->TheoraDecoder=th_decode_alloc(&mInfo->TheoraInfo,mInfo->TheoraSetup);
@@ -802,8 +1487,31 @@ void TheoraVideoClip::doSeek()
 	// previous keyframe and seek to it.
 	// then by setting the correct time, the decoder will skip N frames untill
 	// we get the frame we want.
-	frame=seekPage(targetFrame,1);
-	if (frame != -1) seekPage(std::max(0,frame),0);
+	TheoraSeekIndex::Entry page;
+	long keyframe;
+	if (mSeekIndex->find(targetFrame,_isSeekIndexComplete(),&page,&keyframe))
+	{
+		// the index knows where the keyframe is, start reading at the page before it
+		ogg_sync_reset(&mInfo->OggSyncState);
+		mStream->seek(page.offset);
+		while (ogg_sync_pageout(&mInfo->OggSyncState,&mInfo->OggPage) != 1)
+		{
+			int chunkSize=getReadChunkSize();
+			char *buffer = ogg_sync_buffer( &mInfo->OggSyncState, chunkSize);
+			int bytesRead = mStream->read( buffer, chunkSize);
+			if (bytesRead == 0) break;
+			ogg_sync_wrote( &mInfo->OggSyncState, bytesRead );
+		}
+		ogg_stream_pagein(&mInfo->TheoraStreamState,&mInfo->OggPage);
+		// frames before the keyframe are skipped, so the decoder has to count on from the frame before it
+		ogg_int64_t granule=(ogg_int64_t) (keyframe-1+_granuleBias(&mInfo->TheoraInfo)) << mInfo->TheoraInfo.keyframe_granule_shift;
+		th_decode_ctl(mInfo->TheoraDecoder,TH_DECCTL_SET_GRANPOS,&granule,sizeof(granule));
+	}
+	else
+	{
+		frame=seekPage(targetFrame,1);
+		if (frame != -1) seekPage(std::max(0,frame),0);
+	}
 
 	float time=((float) targetFrame/mNumFrames)*mDuration;
 
@@ -838,8 +1546,9 @@ void TheoraVideoClip::doSeek()
 			}
 			else
 			{
-				char *buffer = ogg_sync_buffer( &mInfo->OggSyncState, 4096);
-				int bytesRead = mStream->read( buffer, 4096);
+				int chunkSize=getReadChunkSize();
+				char *buffer = ogg_sync_buffer( &mInfo->OggSyncState, chunkSize);
+				int bytesRead = mStream->read( buffer, chunkSize);
 				if (bytesRead == 0) break;
 				ogg_sync_wrote( &mInfo->OggSyncState, bytesRead );
 			}
@@ -849,25 +1558,126 @@ void TheoraVideoClip::doSeek()
 	mTimer->seek(time);
 	mSeekPos=-2; // tell the decoder to discard frames until the keyframe is found
 	if (mAudioInterface) mAudioMutex->unlock();
+	mDemuxMutex->unlock();
 }
 
 void TheoraVideoClip::seek(float time)
 {
 	mSeekPos=time;
 	mEndOfFile=false;
+	TheoraVideoManager::getSingleton()._signalWork(this);
+}
+
+TheoraVideoClipView* TheoraVideoClip::createView()
+{
+	TheoraVideoClipView* view=new TheoraVideoClipView(this);
+	mViews.push_back(view);
+	return view;
+}
+
+void TheoraVideoClip::destroyView(TheoraVideoClipView* view)
+{
+	foreach(TheoraVideoClipView*,mViews)
+		if (*it == view)
+		{
+			mViews.erase(it);
+			delete view;
+			// frames the view was holding may be free now
+			TheoraVideoManager::getSingleton()._signalWork(this);
+			break;
+		}
+}
+
+void TheoraVideoClip::_updatePostProcessing(float decodeTime)
+{
+	if (!mAdaptivePP)
+	{
+		// the level may have been set before the clip was loaded and the maximum known
+		mPPLevel=(mUserPPLevel > mMaxPPLevel) ? mMaxPPLevel : mUserPPLevel;
+		return;
+	}
+	mDecodeTime=(mDecodeTime < 0) ? decodeTime : mDecodeTime*0.9f+decodeTime*0.1f;
+	mPPFrames++;
+	float interval=(float) mInfo->TheoraInfo.fps_denominator/mInfo->TheoraInfo.fps_numerator,
+	      speed=mTimer->getSpeed();
+	if (speed > 0.01f) interval/=speed;
+	// frames displayed late right after a change were mostly decoded at the old level
+	bool late=(mNumLateFrames != mPPLateFrames);
+	mPPLateFrames=mNumLateFrames;
+
+	int level=mPPLevel;
+	if ((late || mDecodeTime > interval*TH_PP_STEP_DOWN_LOAD) && mPPFrames >= TH_PP_STEP_DOWN_FRAMES)
+	{
+		if (level > 0) level--;
+	}
+	else if (mDecodeTime < interval*TH_PP_STEP_UP_LOAD && mPPFrames >= TH_PP_STEP_UP_FRAMES)
+	{
+		if (level < mMaxPPLevel) level++;
+	}
+	if (level != mPPLevel)
+	{
+#ifdef _DEBUG
+		th_writelog(mName+": post-processing level "+str(level));
+#endif
+		// the average was measured at the old level, start over
+		mPPLevel=level;
+		mPPFrames=0;
+		mDecodeTime=-1;
+	}
+}
+
+void TheoraVideoClip::setPostProcessingLevel(int level)
+{
+	// clamped to getMaxPostProcessingLevel() by the decoder, it isn't known until the clip is loaded
+	mUserPPLevel=(level < 0) ? 0 : level;
+}
+
+void TheoraVideoClip::setAdaptivePostProcessing(bool value)
+{
+	mAdaptivePP=value;
+}
+
+void TheoraVideoClip::setDirtyTileTracking(bool value)
+{
+	mDirtyTileTracking=value;
+}
+
+void TheoraVideoClip::setLoopCacheBudget(int bytes)
+{
+	// the decoder fills the cache during the next pass, or frees it at the end of the loop
+	mLoopCacheBudget=(bytes > 0) ? bytes : 0;
+}
+
+int TheoraVideoClip::getLoopCacheSize()
+{
+	return mLoopCache->getSize();
+}
+
+void TheoraVideoClip::setPriority(float priority)
+{
+	mUserPriority=(priority > 0.001f) ? priority : 0.001f;
+	TheoraVideoManager::getSingleton()._signalWork(this);
+}
+
+void TheoraVideoClip::setVisible(bool visible)
+{
+	mVisible=visible;
 }
 
 float TheoraVideoClip::getPriority()
 {
-	// TODO
-	return getNumPrecachedFrames()*10.0f;
+	return mUserPriority;
 }
 
 float TheoraVideoClip::getPriorityIndex()
 {
-	float priority=(float) getNumReadyFrames();
-	if (mTimer->isPaused()) priority+=getNumPrecachedFrames()/2;
-	return priority;
+	float fps=(float) mInfo->TheoraInfo.fps_numerator/mInfo->TheoraInfo.fps_denominator,
+	      speed=mTimer->getSpeed(),
+	      frames=(float) getNumReadyFrames();
+	if (mTimer->isPaused()) frames+=getEffectiveNumPrecachedFrames()/2;
+	if (speed < 0.01f) speed=0.01f;
+	// time until the first frame that isn't decoded yet has to be displayed
+	return frames/(fps*speed)/mUserPriority;
 }
 
 void TheoraVideoClip::setAudioInterface(TheoraAudioInterface* iface)
@@ -895,5 +1705,9 @@ float TheoraVideoClip::getAudioGain()
 void TheoraVideoClip::setAutoRestart(bool value)
 {
 	mAutoRestart=value;
-	if (value) mEndOfFile=false;
+	if (value)
+	{
+		mEndOfFile=false;
+		TheoraVideoManager::getSingleton()._signalWork(this);
+	}
 }
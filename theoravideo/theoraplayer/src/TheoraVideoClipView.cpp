@@ -0,0 +1,68 @@
+/************************************************************************************
+This source file is part of the Theora Video Playback Library
+For latest info, see http://libtheoraplayer.sourceforge.net/
+*************************************************************************************
+Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
+This program is free software; you can redistribute it and/or modify it under
+the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
+*************************************************************************************/
+#include "TheoraVideoClipView.h"
+#include "TheoraVideoClip.h"
+#include "TheoraVideoFrame.h"
+#include "TheoraVideoManager.h"
+#include "TheoraFrameQueue.h"
+#include "TheoraTimer.h"
+#include "TheoraUtil.h"
+
+TheoraVideoClipView::TheoraVideoClipView(TheoraVideoClip* clip) :
+	mClip(clip),
+	mHead(0),
+	mLastTime(0),
+	mNumDroppedFrames(0),
+	mNumDisplayedFrames(0)
+{
+	mClip->mFrameQueue->addView(&mHead);
+}
+
+TheoraVideoClipView::~TheoraVideoClipView()
+{
+	mClip->mFrameQueue->removeView(&mHead);
+}
+
+TheoraVideoFrame* TheoraVideoClipView::getNextFrame()
+{
+	TheoraFrameQueue* queue=mClip->mFrameQueue;
+	TheoraVideoFrame* frame;
+	float time=mClip->mTimer->getTime();
+	// the clip's update() drops the frames left over from the end of the video when it
+	// loops, this view has to drop its own. they are the ones far ahead of the timer
+	bool looped=time < mLastTime;
+	mLastTime=time;
+	for (;;)
+	{
+		frame=queue->getFirstAvailableFrame(&mHead);
+		if (!frame) return 0;
+		if (!looped || frame->mTimeToDisplay <= time+0.5f)
+		{
+			if (frame->mTimeToDisplay > time) return 0;
+			if (frame->mTimeToDisplay >= time-0.1) break;
+			if (mClip->mRestarted && frame->mTimeToDisplay < 2) return 0;
+		}
+		// late, or left over from before the clip looped
+		mNumDroppedFrames++;
+		popFrame();
+	}
+	return frame;
+}
+
+void TheoraVideoClipView::popFrame()
+{
+	mNumDisplayedFrames++;
+	mClip->mFrameQueue->pop(&mHead);
+	TheoraVideoManager::getSingleton()._signalWork(mClip);
+}
+
+int TheoraVideoClipView::getNumReadyFrames()
+{
+	return mClip->mFrameQueue->getReadyCount(&mHead);
+}
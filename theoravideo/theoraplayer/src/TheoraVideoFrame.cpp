@@ -22,6 +22,17 @@ http://www.gnu.org/copyleft/lesser.txt.
 #include <theora/theoradec.h>
 #include "TheoraVideoFrame.h"
 #include "TheoraVideoClip.h"
+#include "TheoraVideoManager.h"
+#include "TheoraConversion.h"
+#include "TheoraFramePool.h"
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#define TH_X86
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#define TH_X86
+#endif
 
 // clips a value between [0,255] using fast bitwise operations
 #define CLIP_RGB_COLOR(x) ((x & 0xFFFFFF00) == 0 ? x : (x & 0x80000000 ? 0 : 255))
@@ -118,6 +129,14 @@ void _decodeBGR(th_img_plane* yuv,unsigned char* out,int stride,int nBytes)
 	}
 }
 
+//! sets the alpha byte of each pixel to opaque, 'out' points to the alpha byte of the first pixel.
+//! the SIMD converters write alpha as well, so frames don't depend on what the buffer held before
+void _setAlpha(unsigned char* out,int stride,int width,int height)
+{
+	for (int y=0;y<height;y++,out+=stride)
+		for (int x=0;x<width;x++) out[x*4]=255;
+}
+
 void decodeRGB(th_img_plane* yuv,unsigned char* out,int stride)
 {
 	_decodeRGB(yuv,out,stride*3,3);
@@ -126,11 +145,13 @@ void decodeRGB(th_img_plane* yuv,unsigned char* out,int stride)
 void decodeRGBA(th_img_plane* yuv,unsigned char* out,int stride)
 {
 	_decodeRGB(yuv,out,stride*4,4);
+	_setAlpha(out+3,stride*4,yuv[0].width,(yuv[0].height+1) & ~1);
 }
 
 void decodeARGB(th_img_plane* yuv,unsigned char* out,int stride)
 {
 	_decodeRGB(yuv,out+1,stride*4,4);
+	_setAlpha(out,stride*4,yuv[0].width,(yuv[0].height+1) & ~1);
 }
 
 void decodeBGR(th_img_plane* yuv,unsigned char* out,int stride)
@@ -141,11 +162,13 @@ void decodeBGR(th_img_plane* yuv,unsigned char* out,int stride)
 void decodeBGRA(th_img_plane* yuv,unsigned char* out,int stride)
 {
 	_decodeBGR(yuv,out,stride*4,4);
+	_setAlpha(out+3,stride*4,yuv[0].width,(yuv[0].height+1) & ~1);
 }
 
 void decodeABGR(th_img_plane* yuv,unsigned char* out,int stride)
 {
 	_decodeBGR(yuv,out+1,stride*4,4);
+	_setAlpha(out,stride*4,yuv[0].width,(yuv[0].height+1) & ~1);
 }
 
 void decodeGrey(th_img_plane* yuv,unsigned char* out,int stride)
@@ -172,11 +195,13 @@ void decodeGrey3(th_img_plane* yuv,unsigned char* out,int stride)
 void decodeGreyX(th_img_plane* yuv,unsigned char* out,int stride)
 {
 	_decodeGrey3(yuv,out,stride*4,4);
+	_setAlpha(out+3,stride*4,yuv[0].width,yuv[0].height);
 }
 
 void decodeXGrey(th_img_plane* yuv,unsigned char* out,int stride)
 {
 	_decodeGrey3(yuv,out+1,stride*4,4);
+	_setAlpha(out,stride*4,yuv[0].width,yuv[0].height);
 }
 
 
@@ -217,14 +242,45 @@ void decodeYUV(th_img_plane* yuv,unsigned char* out,int stride)
 void decodeYUVA(th_img_plane* yuv,unsigned char* out,int stride)
 {
 	_decodeYUV(yuv,out,stride*4,4);
+	_setAlpha(out+3,stride*4,yuv[0].width,(yuv[0].height+1) & ~1);
 }
 
 void decodeAYUV(th_img_plane* yuv,unsigned char* out,int stride)
 {
 	_decodeYUV(yuv,out+1,stride*4,4);
+	_setAlpha(out,stride*4,yuv[0].width,(yuv[0].height+1) & ~1);
+}
+
+void _copyPlane(th_img_plane* plane,unsigned char* out,int stride)
+{
+	unsigned char* src=plane->data;
+	for (int y=0;y<plane->height;y++,src+=plane->stride,out+=stride)
+		memcpy(out,src,plane->width);
 }
 
-void (*conversion_functions[])(th_img_plane*,unsigned char*,int)={0,
+void decodeYUV420P(th_img_plane* yuv,unsigned char* out,int stride)
+{
+	// planes are stored one after another, chroma planes use half the luma stride
+	int lumaSize=stride*yuv[0].height,chromaSize=(stride/2)*(yuv[0].height/2);
+	_copyPlane(&yuv[0],out,stride);
+	_copyPlane(&yuv[1],out+lumaSize,stride/2);
+	_copyPlane(&yuv[2],out+lumaSize+chromaSize,stride/2);
+}
+
+void decodeNV12(th_img_plane* yuv,unsigned char* out,int stride)
+{
+	// luma plane followed by a plane of interleaved chroma, both use the same stride
+	unsigned char *uSrc=yuv[1].data,*vSrc=yuv[2].data,*uv=out+stride*yuv[0].height;
+	_copyPlane(&yuv[0],out,stride);
+	for (int y=0;y<yuv[1].height;y++,uSrc+=yuv[1].stride,vSrc+=yuv[2].stride,uv+=stride)
+		for (int x=0;x<yuv[1].width;x++)
+		{
+			uv[x*2]  =uSrc[x];
+			uv[x*2+1]=vSrc[x];
+		}
+}
+
+TheoraConversionFunction reference_conversion_functions[TH_NUM_OUTPUT_MODES]={0,
     decodeRGB,  //TH_RGB
 	decodeRGBA, //TH_RGBA
 	decodeARGB, //TH_ARGB
@@ -238,23 +294,179 @@ void (*conversion_functions[])(th_img_plane*,unsigned char*,int)={0,
 	decodeYUV,  //TH_YUV
 	decodeYUVA, //TH_YUVX
 	decodeAYUV, //TH_XYUV
+	decodeYUV420P, //TH_YUV420P
+	decodeNV12, //TH_NV12
 };
+
+TheoraConversionFunction conversion_functions[TH_NUM_OUTPUT_MODES];
+
+int _getBytesPerPixel(TheoraOutputMode mode)
+{
+	static const int bytemap[TH_NUM_OUTPUT_MODES]={0,3,4,4,3,4,4,1,3,4,4,3,4,4,1,1};
+	return bytemap[mode];
+}
+
+int _getNumPlanes(TheoraOutputMode mode)
+{
+	if (mode == TH_YUV420P) return 3;
+	if (mode == TH_NV12) return 2;
+	return 1;
+}
+
+void _convertTail(TheoraOutputMode mode,th_img_plane* yuv,unsigned char* out,int stride,int x)
+{
+	if (x >= yuv[0].width) return;
+	th_img_plane tail[3];
+	for (int i=0;i<3;i++)
+	{
+		int offset=(i == 0) ? x : x/2;
+		tail[i]=yuv[i];
+		tail[i].data+=offset;
+		tail[i].width-=offset;
+	}
+	reference_conversion_functions[mode](tail,out+x*_getBytesPerPixel(mode),stride);
+}
+
+int _getCPUFeatures()
+{
+	int features=0;
+#ifdef TH_X86
+	unsigned int regs[4]={0,0,0,0},max_leaf;
+#ifdef _MSC_VER
+	__cpuid((int*) regs,0);
+	max_leaf=regs[0];
+	__cpuid((int*) regs,1);
+#else
+	max_leaf=__get_cpuid_max(0,0);
+	__cpuid(1,regs[0],regs[1],regs[2],regs[3]);
+#endif
+	if (regs[3] & (1 << 26)) features|=TH_CPU_SSE2;
+
+	// AVX2 needs both the CPU flag and the OS saving the YMM registers (OSXSAVE + XCR0)
+	bool ymm=false;
+	if ((regs[2] & (1 << 27)) && (regs[2] & (1 << 28)))
+	{
+#ifdef _MSC_VER
+		ymm=(_xgetbv(0) & 6) == 6;
+#else
+		unsigned int xcr0_lo,xcr0_hi;
+		__asm__ __volatile__("xgetbv" : "=a"(xcr0_lo),"=d"(xcr0_hi) : "c"(0));
+		ymm=(xcr0_lo & 6) == 6;
+#endif
+	}
+	if (ymm && max_leaf >= 7)
+	{
+#ifdef _MSC_VER
+		__cpuidex((int*) regs,7,0);
+#else
+		__cpuid_count(7,0,regs[0],regs[1],regs[2],regs[3]);
+#endif
+		if (regs[1] & (1 << 5)) features|=TH_CPU_AVX2;
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	features|=TH_CPU_NEON;
+#endif
+	return features;
+}
+
+const char* _selectConversionFunctions(int cpu_features)
+{
+	const char* name="C";
+	memcpy(conversion_functions,reference_conversion_functions,sizeof(conversion_functions));
+	// later instruction sets override the kernels of earlier ones
+	if ((cpu_features & TH_CPU_NEON) && _getNEONConversionFunctions(conversion_functions)) name="NEON";
+	if ((cpu_features & TH_CPU_SSE2) && _getSSE2ConversionFunctions(conversion_functions)) name="SSE2";
+	if ((cpu_features & TH_CPU_AVX2) && _getAVX2ConversionFunctions(conversion_functions)) name="AVX2";
+	return name;
+}
+
+std::string selectConversionFunctions()
+{
+	return _selectConversionFunctions(_getCPUFeatures());
+}
+
+void _convertRows(TheoraOutputMode mode,th_img_plane* yuv,unsigned char* out,int stride,int y0,int y1)
+{
+	th_img_plane rows[3];
+	if (y1 > yuv[0].height) y1=yuv[0].height;
+	if (y0 >= y1) return;
+	rows[0]=yuv[0];
+	rows[0].data+=y0*rows[0].stride;
+	rows[0].height=y1-y0;
+	for (int i=1;i<3;i++)
+	{
+		rows[i]=yuv[i];
+		rows[i].data+=(y0/2)*rows[i].stride;
+		rows[i].height=(y1-y0+1)/2;
+	}
+	conversion_functions[mode](rows,out+y0*stride*_getBytesPerPixel(mode),stride);
+}
+
+int _getNumConversionBands(TheoraOutputMode mode,int height)
+{
+	// planar converters place the chroma planes relative to the luma height, so they
+	// can't work on bands. they're bound by memory bandwidth anyway
+	if (_getNumPlanes(mode) > 1) return 1;
+	int nThreads=TheoraVideoManager::getSingleton().getNumWorkerThreads();
+	if (nThreads < 2) return 1;
+	// a few more bands than threads to balance out helpers joining late
+	int nBands=nThreads*2;
+	if (nBands > height/TH_MIN_CONVERSION_BAND_HEIGHT) nBands=height/TH_MIN_CONVERSION_BAND_HEIGHT;
+	return (nBands > 1) ? nBands : 1;
+}
+
+TheoraConversionJob::TheoraConversionJob(TheoraOutputMode mode,th_img_plane* yuv,unsigned char* out,int stride,int nBands) :
+	mMode(mode),
+	mOut(out),
+	mStride(stride),
+	mNextBand(0),
+	mNumHelpers(0)
+{
+	for (int i=0;i<3;i++) mPlanes[i]=yuv[i];
+	// bands start on even rows so they don't split chroma rows
+	mBandHeight=((yuv[0].height+nBands-1)/nBands+1) & ~1;
+	mNumBands=(yuv[0].height+mBandHeight-1)/mBandHeight;
+}
+
+bool TheoraConversionJob::hasBands()
+{
+	return mNextBand.load() < mNumBands;
+}
+
+void TheoraConversionJob::run()
+{
+	int b;
+	while ((b=mNextBand.fetch_add(1)) < mNumBands)
+		_convertRows(mMode,mPlanes,mOut,mStride,b*mBandHeight,(b+1)*mBandHeight);
+}
 // --------------------------------------------------------------
 TheoraVideoFrame::TheoraVideoFrame(TheoraVideoClip* parent)
 {
 	mReady=mInUse=false;
 	mParent=parent;
 	mIteration=0;
-	// number of bytes based on output mode
-	int bytemap[]={0,3,4,4,3,4,4,1,3,4,4,3,4,4};
-	int size=mParent->mStride * mParent->mHeight * bytemap[mParent->getOutputMode()];
-	mBuffer=new unsigned char[size];
-	memset(mBuffer,255,size);
+	mStride=mParent->mStride;
+	TheoraOutputMode mode=mParent->getOutputMode();
+	int size=0;
+	for (int i=0;i<_getNumPlanes(mode);i++)
+		size+=getPlaneStride(i)*getPlaneHeight(i);
+	mBufferSize=size;
+	// allocated when it's first needed, frames may be converted into application buffers instead
+	mBuffer=mOwnBuffer=NULL;
+	mExternalBuffer=0;
+
+	mSerial=0;
+	mNumTilesX=(mParent->mWidth+TH_DIRTY_TILE_SIZE-1)/TH_DIRTY_TILE_SIZE;
+	mNumTilesY=(mParent->mHeight+TH_DIRTY_TILE_SIZE-1)/TH_DIRTY_TILE_SIZE;
+	// allocated when the frame is first compared against a reference, see _beginDirtyTiles()
+	mDirtyTiles=NULL;
+	_beginDirtyTiles(NULL);
 }
 
 TheoraVideoFrame::~TheoraVideoFrame()
 {
-	if (mBuffer) delete [] mBuffer;
+	if (mOwnBuffer) TheoraVideoManager::getSingleton()._getFramePool()->release(mOwnBuffer,mBufferSize);
+	delete [] mDirtyTiles;
 }
 
 int TheoraVideoFrame::getWidth()
@@ -264,7 +476,7 @@ int TheoraVideoFrame::getWidth()
 
 int TheoraVideoFrame::getStride()
 {
-	return mParent->mStride;
+	return mStride;
 }
 
 int TheoraVideoFrame::getHeight()
@@ -277,12 +489,166 @@ unsigned char* TheoraVideoFrame::getBuffer()
 	return mBuffer;
 }
 
+unsigned char* TheoraVideoFrame::getPlane(int plane)
+{
+	if (plane < 0 || plane >= _getNumPlanes(mParent->getOutputMode())) return 0;
+	unsigned char* data=mBuffer;
+	for (int i=0;i<plane;i++)
+		data+=getPlaneStride(i)*getPlaneHeight(i);
+	return data;
+}
+
+int TheoraVideoFrame::getPlaneStride(int plane)
+{
+	TheoraOutputMode mode=mParent->getOutputMode();
+	int stride=mStride*_getBytesPerPixel(mode);
+	// NV12 chroma rows hold width/2 U,V pairs, so they're as wide as luma rows
+	return (plane == 0 || mode == TH_NV12) ? stride : stride/2;
+}
+
+int TheoraVideoFrame::getPlaneWidth(int plane)
+{
+	return (plane == 0) ? mParent->mWidth : mParent->mWidth/2;
+}
+
+int TheoraVideoFrame::getPlaneHeight(int plane)
+{
+	return (plane == 0) ? mParent->mHeight : mParent->mHeight/2;
+}
+
 void TheoraVideoFrame::decode(void* yuv)
 {
-	conversion_functions[mParent->getOutputMode()]((th_img_plane*) yuv,mBuffer,mParent->mStride);
+	TheoraOutputMode mode=mParent->getOutputMode();
+	th_img_plane* planes=(th_img_plane*) yuv;
+	int nBands=_getNumConversionBands(mode,planes[0].height);
+	if (nBands > 1)
+	{
+		// large frame, let idle worker threads convert some of the bands
+		TheoraConversionJob job(mode,planes,mBuffer,mStride,nBands);
+		TheoraVideoManager::getSingleton()._runConversionJob(&job);
+	}
+	else
+		conversion_functions[mode](planes,mBuffer,mStride);
 	mReady=true;
 }
 
+void TheoraVideoFrame::decodeRows(void* yuv,int y0,int y1)
+{
+	_convertRows(mParent->getOutputMode(),(th_img_plane*) yuv,mBuffer,mStride,y0,y1);
+}
+
+void TheoraVideoFrame::_setOutputBuffer(unsigned char* buffer,int stride)
+{
+	if (buffer)
+	{
+		mBuffer=buffer;
+		mStride=stride;
+		mExternalBuffer=1;
+		return;
+	}
+	if (!mOwnBuffer)
+	{
+		bool allocated;
+		mOwnBuffer=TheoraVideoManager::getSingleton()._getFramePool()->acquire(mBufferSize,&allocated);
+		// converters write every pixel including alpha, so a reused buffer only has stale
+		// bytes in the stride padding. new ones are cleared so the padding is never uninitialised
+		if (allocated) memset(mOwnBuffer,255,mBufferSize);
+	}
+	_detachOutputBuffer();
+}
+
+void TheoraVideoFrame::_detachOutputBuffer()
+{
+	mBuffer=mOwnBuffer;
+	mStride=mParent->mStride;
+	mExternalBuffer=0;
+}
+
+void TheoraVideoFrame::_takeOwnBuffer(TheoraVideoFrame* frame)
+{
+	mOwnBuffer=frame->mOwnBuffer;
+	frame->mOwnBuffer=NULL;
+	if (!mExternalBuffer) mBuffer=mOwnBuffer;
+	if (!frame->mExternalBuffer) frame->mBuffer=NULL;
+}
+
+void TheoraVideoFrame::_freeOwnBuffer()
+{
+	TheoraVideoManager::getSingleton()._getFramePool()->release(mOwnBuffer,mBufferSize);
+	mOwnBuffer=NULL;
+	if (!mExternalBuffer) mBuffer=NULL;
+}
+
+void TheoraVideoFrame::_copyPlanes(unsigned char* dst,int dstStride,const unsigned char* src,int srcStride)
+{
+	if (dstStride == srcStride)
+	{
+		memcpy(dst,src,mBufferSize);
+		return;
+	}
+	TheoraOutputMode mode=mParent->getOutputMode();
+	int bpp=_getBytesPerPixel(mode);
+	for (int p=0;p<_getNumPlanes(mode);p++)
+	{
+		// pitches of the plane in both layouts, see getPlaneStride()
+		int d=dstStride*bpp,s=srcStride*bpp;
+		if (p > 0 && mode != TH_NV12) { d/=2; s/=2; }
+		int n=(d < s) ? d : s;
+		for (int y=0;y<getPlaneHeight(p);y++,dst+=d,src+=s)
+			memcpy(dst,src,n);
+	}
+}
+
+void TheoraVideoFrame::_copyTo(unsigned char* data)
+{
+	_copyPlanes(data,mParent->mStride,mBuffer,mStride);
+}
+
+void TheoraVideoFrame::_copyFrom(const unsigned char* data)
+{
+	_copyPlanes(mBuffer,mStride,data,mParent->mStride);
+}
+
+void TheoraVideoFrame::_beginDirtyTiles(TheoraVideoFrame* reference)
+{
+	int n=mNumTilesX*mNumTilesY;
+	mReference=reference;
+	mDirtyReference=reference ? reference->mSerial : 0;
+	// without a reference every tile is dirty, isTileDirty() doesn't look at the mask then
+	mNumDirtyTiles=reference ? 0 : n;
+	if (!reference) return;
+	if (!mDirtyTiles) mDirtyTiles=new unsigned char[n];
+	memset(mDirtyTiles,0,n);
+}
+
+void TheoraVideoFrame::_updateDirtyTiles(int y0,int y1)
+{
+	if (!mReference) return;
+	int nPlanes=_getNumPlanes(mParent->getOutputMode());
+	for (int p=0;p<nPlanes && mNumDirtyTiles < mNumTilesX*mNumTilesY;p++)
+	{
+		// chroma planes have half as many rows. the bytes of a row that belong to a tile
+		// scale with the plane's row size, padding beyond the frame width is skipped
+		int shift=(p == 0) ? 0 : 1,pitch=getPlaneStride(p),refPitch=mReference->getPlaneStride(p),
+		    rowBytes=mParent->mWidth*pitch/mStride,tileBytes=TH_DIRTY_TILE_SIZE*pitch/mStride,n;
+		unsigned char *a=getPlane(p),*b=mReference->getPlane(p),*mask;
+		for (int y=y0 >> shift;y<(y1 >> shift);y++)
+		{
+			mask=mDirtyTiles+((y << shift)/TH_DIRTY_TILE_SIZE)*mNumTilesX;
+			for (int x=0,tx=0;x<rowBytes;x+=tileBytes,tx++)
+			{
+				if (mask[tx]) continue;
+				n=(rowBytes-x < tileBytes) ? rowBytes-x : tileBytes;
+				if (memcmp(a+y*pitch+x,b+y*refPitch+x,n) != 0)
+				{
+					mask[tx]=1;
+					mNumDirtyTiles++;
+				}
+			}
+		}
+	}
+}
+
 void TheoraVideoFrame::clear()
 {
 	mInUse=mReady=false;
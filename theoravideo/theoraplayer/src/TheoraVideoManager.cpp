@@ -6,17 +6,22 @@ Copyright (c) 2008-2010 Kresimir Spes (kreso@cateia.com)
 This program is free software; you can redistribute it and/or modify it under
 the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
 *************************************************************************************/
+#include <algorithm>
 #include "TheoraVideoManager.h"
 #include "TheoraWorkerThread.h"
 #include "TheoraVideoClip.h"
 #include "TheoraAudioInterface.h"
 #include "TheoraUtil.h"
 #include "TheoraDataSource.h"
+#include "TheoraException.h"
+#include "TheoraConversion.h"
+#include "TheoraFramePool.h"
 
 TheoraVideoManager* g_ManagerSingleton=0;
-// declaring function prototype here so I don't have to put it in a header file
-// it only needs to be used by this plugin and called once
+// declaring function prototypes here so I don't have to put them in a header file
+// they only need to be used by this plugin and called once
 void createYUVtoRGBtables();
+std::string selectConversionFunctions();
 
 void theora_writelog(std::string output)
 {
@@ -41,7 +46,9 @@ TheoraVideoManager& TheoraVideoManager::getSingleton()
 }
 
 TheoraVideoManager::TheoraVideoManager(int num_worker_threads) : 
-	mDefaultNumPrecachedFrames(16)
+	mClock(0),
+	mDefaultNumPrecachedFrames(16),
+	mFrameMemoryBudget(0)
 {
 	g_ManagerSingleton=this;
 
@@ -49,9 +56,12 @@ TheoraVideoManager::TheoraVideoManager(int num_worker_threads) :
 
 	mAudioFactory = NULL;
 	mWorkMutex=new TheoraMutex();
+	mWorkEvent=new TheoraEvent();
+	mFramePool=new TheoraFramePool();
 
 	// for CPU yuv2rgb decoding
 	createYUVtoRGBtables();
+	logMessage("Using "+selectConversionFunctions()+" colour conversion");
 	createWorkerThreads(num_worker_threads);
 }
 
@@ -64,6 +74,9 @@ TheoraVideoManager::~TheoraVideoManager()
 		delete (*ci);
 	mClips.clear();
 	delete mWorkMutex;
+	delete mWorkEvent;
+	// after the clips, their frames return buffers to the pool
+	delete mFramePool;
 }
 
 void TheoraVideoManager::logMessage(std::string msg)
@@ -89,6 +102,26 @@ TheoraAudioInterfaceFactory* TheoraVideoManager::getAudioInterfaceFactory()
 	return mAudioFactory;
 }
 
+void TheoraVideoManager::setFrameBufferPoolLimit(size_t bytes)
+{
+	mFramePool->setLimit(bytes);
+}
+
+size_t TheoraVideoManager::getFrameBufferPoolLimit()
+{
+	return mFramePool->getLimit();
+}
+
+void TheoraVideoManager::trimFrameBufferPool()
+{
+	mFramePool->trim();
+}
+
+TheoraFramePoolStats TheoraVideoManager::getFrameBufferPoolStats()
+{
+	return mFramePool->getStats();
+}
+
 TheoraVideoClip* TheoraVideoManager::createVideoClip(std::string filename,
 													 TheoraOutputMode output_mode,
 													 int numPrecachedOverride,
@@ -103,14 +136,56 @@ TheoraVideoClip* TheoraVideoManager::createVideoClip(TheoraDataSource* data_sour
 													 int numPrecachedOverride,
 													 bool usePower2Stride)
 {
-	mWorkMutex->lock();
-
 	TheoraVideoClip* clip = NULL;
 	int nPrecached = numPrecachedOverride ? numPrecachedOverride : mDefaultNumPrecachedFrames;
 	logMessage("Creating video from data source: "+data_source->repr());
 	clip = new TheoraVideoClip(data_source,output_mode,nPrecached,usePower2Stride);
+	// the clip isn't registered yet, so loading it doesn't hold up the worker threads
+	try
+	{
+		clip->load(data_source);
+	}
+	catch (_TheoraGenericException&)
+	{
+		delete clip;
+		throw;
+	}
+	mWorkMutex->lock();
+	mClips.push_back(clip);
+	mWorkMutex->unlock();
+	_signalWork(clip);
+	return clip;
+}
+
+TheoraVideoClip* TheoraVideoManager::createVideoClipAsync(std::string filename,
+														  TheoraOutputMode output_mode,
+														  TheoraClipLoadedCallback callback,
+														  void* user_data,
+														  int numPrecachedOverride,
+														  bool usePower2Stride)
+{
+	// the file is opened by the worker thread as well, see TheoraFileDataSource
+	TheoraDataSource* src=new TheoraFileDataSource(filename,1);
+	return createVideoClipAsync(src,output_mode,callback,user_data,numPrecachedOverride,usePower2Stride);
+}
+
+TheoraVideoClip* TheoraVideoManager::createVideoClipAsync(TheoraDataSource* data_source,
+														  TheoraOutputMode output_mode,
+														  TheoraClipLoadedCallback callback,
+														  void* user_data,
+														  int numPrecachedOverride,
+														  bool usePower2Stride)
+{
+	int nPrecached = numPrecachedOverride ? numPrecachedOverride : mDefaultNumPrecachedFrames;
+	logMessage("Creating video from data source (async): "+data_source->repr());
+	TheoraVideoClip* clip = new TheoraVideoClip(data_source,output_mode,nPrecached,usePower2Stride);
+	clip->mLoadCallback=callback;
+	clip->mLoadCallbackData=user_data;
+	mWorkMutex->lock();
 	mClips.push_back(clip);
+	mLoadQueue.push_back(clip);
 	mWorkMutex->unlock();
+	_signalWork();
 	return clip;
 }
 
@@ -120,11 +195,16 @@ void TheoraVideoManager::destroyVideoClip(TheoraVideoClip* clip)
 	{
 		th_writelog("Destroying video clip: "+clip->getName());
 		mWorkMutex->lock();
+		clip->mDestroying=1;
+		unscheduleClip(clip);
 		bool reported=0;
-		while (clip->mAssignedWorkerThread)
+		while (clip->mAssignedWorkerThread || clip->mDemuxThread)
 		{
 			if (!reported) { th_writelog("Waiting for WorkerThread to finish decoding in order to destroy"); reported=1; }
+			// the worker needs the mutex to hand the clip back, see finishWork()
+			mWorkMutex->unlock();
 			_psleep(1);
+			mWorkMutex->lock();
 		}
 		if (reported) th_writelog("WorkerThread done, destroying..");
 		foreach(TheoraVideoClip*,mClips)
@@ -133,6 +213,18 @@ void TheoraVideoManager::destroyVideoClip(TheoraVideoClip* clip)
 				mClips.erase(it);
 				break;
 			}
+		foreach(TheoraVideoClip*,mLoadQueue)
+			if ((*it) == clip)
+			{
+				mLoadQueue.erase(it);
+				break;
+			}
+		foreach(TheoraVideoClip*,mLoadedClips)
+			if ((*it) == clip)
+			{
+				mLoadedClips.erase(it);
+				break;
+			}
 		delete clip;
 		th_writelog("Destroyed video.");
 		mWorkMutex->unlock();
@@ -145,33 +237,322 @@ TheoraVideoClip* TheoraVideoManager::requestWork(TheoraWorkerThread* caller)
 	mWorkMutex->lock();
 	TheoraVideoClip* c=NULL;
 
-	float priority,last_priority=100000;
+	// clips that ran out of work since they were queued are dropped here,
+	// they are queued again by _signalWork() when they get new work
+	while (!mWorkQueue.empty())
+	{
+		c=mWorkQueue[0];
+		unscheduleClip(c);
+		if (!c->isBusy() && c->hasWork()) break;
+		c=NULL;
+	}
+	if (c) c->mAssignedWorkerThread=caller;
+	
+	mWorkMutex->unlock();
+	return c;
+}
+
+void TheoraVideoManager::finishWork(TheoraVideoClip* clip)
+{
+	mWorkMutex->lock();
+	clip->mAssignedWorkerThread=NULL;
+	scheduleClip(clip);
+	mWorkMutex->unlock();
+}
+
+TheoraVideoClip* TheoraVideoManager::requestLoadWork(TheoraWorkerThread* caller)
+{
+	mWorkMutex->lock();
+	TheoraVideoClip* c=NULL;
+	if (!mLoadQueue.empty())
+	{
+		c=mLoadQueue.front();
+		mLoadQueue.erase(mLoadQueue.begin());
+		c->mAssignedWorkerThread=caller;
+	}
+	mWorkMutex->unlock();
+	return c;
+}
 
+void TheoraVideoManager::finishLoadWork(TheoraVideoClip* clip)
+{
+	mWorkMutex->lock();
+	clip->mAssignedWorkerThread=NULL;
+	if (!clip->mDestroying) mLoadedClips.push_back(clip);
+	scheduleClip(clip);
+	mWorkMutex->unlock();
+	mWorkEvent->signal();
+}
+
+TheoraVideoClip* TheoraVideoManager::requestDemuxWork(TheoraWorkerThread* caller)
+{
+	mWorkMutex->lock();
+	TheoraVideoClip* c=NULL;
+	int n,least=0;
 	foreach(TheoraVideoClip*,mClips)
 	{
-		if ((*it)->isBusy()) continue;
-		priority=(*it)->getPriorityIndex();
-		if (priority < last_priority)
+		if ((*it)->mDemuxThread || !(*it)->_needsDemux()) continue;
+		n=(*it)->getNumQueuedPackets();
+		if (!c || n < least)
 		{
-			last_priority=priority;
+			least=n;
 			c=*it;
 		}
 	}
-	if (c) c->mAssignedWorkerThread=caller;
-	
+	if (c) c->mDemuxThread=caller;
 	mWorkMutex->unlock();
 	return c;
 }
 
+void TheoraVideoManager::finishDemuxWork(TheoraVideoClip* clip)
+{
+	mWorkMutex->lock();
+	clip->mDemuxThread=NULL;
+	mWorkMutex->unlock();
+}
+
+TheoraConversionJob* TheoraVideoManager::requestConversionJob()
+{
+	TheoraConversionJob* job=NULL;
+	mWorkMutex->lock();
+	foreach(TheoraConversionJob*,mConversionJobs)
+		if ((*it)->hasBands())
+		{
+			job=*it;
+			job->mNumHelpers++;
+			break;
+		}
+	mWorkMutex->unlock();
+	return job;
+}
+
+void TheoraVideoManager::finishConversionJob(TheoraConversionJob* job)
+{
+	mWorkMutex->lock();
+	job->mNumHelpers--;
+	mWorkMutex->unlock();
+	mWorkEvent->signal(); // the owner may be waiting for this job
+}
+
+void TheoraVideoManager::_runConversionJob(TheoraConversionJob* job)
+{
+	mWorkMutex->lock();
+	mConversionJobs.push_back(job);
+	mWorkMutex->unlock();
+	mWorkEvent->signal();
+
+	job->run();
+
+	// all bands are claimed now, no new helpers may join
+	mWorkMutex->lock();
+	foreach(TheoraConversionJob*,mConversionJobs)
+		if ((*it) == job)
+		{
+			mConversionJobs.erase(it);
+			break;
+		}
+	mWorkMutex->unlock();
+
+	// wait for helpers still converting their last band
+	unsigned int events;
+	int nHelpers;
+	for (;;)
+	{
+		events=mWorkEvent->getCount();
+		mWorkMutex->lock();
+		nHelpers=job->mNumHelpers;
+		mWorkMutex->unlock();
+		if (nHelpers == 0) break;
+		mWorkEvent->wait(events);
+	}
+}
+
+void TheoraVideoManager::scheduleClip(TheoraVideoClip* clip)
+{
+	// assigned clips are rescheduled by finishWork()
+	if (clip->mAssignedWorkerThread) return;
+	if (!clip->hasWork())
+	{
+		unscheduleClip(clip);
+		return;
+	}
+	clip->mDeadline=mClock+clip->getPriorityIndex();
+	int i=clip->mScheduleIndex;
+	if (i < 0)
+	{
+		i=clip->mScheduleIndex=mWorkQueue.size();
+		mWorkQueue.push_back(clip);
+	}
+	_heapUp(i);
+	_heapDown(clip->mScheduleIndex);
+}
+
+void TheoraVideoManager::unscheduleClip(TheoraVideoClip* clip)
+{
+	int i=clip->mScheduleIndex,last=mWorkQueue.size()-1;
+	if (i < 0) return;
+	_heapSwap(i,last);
+	mWorkQueue.pop_back();
+	clip->mScheduleIndex=-1;
+	if (i < last)
+	{
+		TheoraVideoClip* moved=mWorkQueue[i];
+		_heapUp(i);
+		_heapDown(moved->mScheduleIndex);
+	}
+}
+
+void TheoraVideoManager::_heapSwap(int a,int b)
+{
+	TheoraVideoClip* c=mWorkQueue[a];
+	mWorkQueue[a]=mWorkQueue[b];
+	mWorkQueue[b]=c;
+	mWorkQueue[a]->mScheduleIndex=a;
+	mWorkQueue[b]->mScheduleIndex=b;
+}
+
+void TheoraVideoManager::_heapUp(int i)
+{
+	while (i > 0 && mWorkQueue[i]->mDeadline < mWorkQueue[(i-1)/2]->mDeadline)
+	{
+		_heapSwap(i,(i-1)/2);
+		i=(i-1)/2;
+	}
+}
+
+void TheoraVideoManager::_heapDown(int i)
+{
+	int n=mWorkQueue.size(),child;
+	for (;;)
+	{
+		child=2*i+1;
+		if (child >= n) break;
+		if (child+1 < n && mWorkQueue[child+1]->mDeadline < mWorkQueue[child]->mDeadline) child++;
+		if (mWorkQueue[i]->mDeadline <= mWorkQueue[child]->mDeadline) break;
+		_heapSwap(i,child);
+		i=child;
+	}
+}
+
+void TheoraVideoManager::_signalWork(TheoraVideoClip* clip)
+{
+	if (clip)
+	{
+		mWorkMutex->lock();
+		scheduleClip(clip);
+		mWorkMutex->unlock();
+	}
+	mWorkEvent->signal();
+}
+
+void TheoraVideoManager::_suspendClip(TheoraVideoClip* clip)
+{
+	mWorkMutex->lock();
+	clip->mSuspended=1;
+	unscheduleClip(clip);
+	while (clip->mAssignedWorkerThread)
+	{
+		// the worker needs the mutex to hand the clip back, see finishWork()
+		mWorkMutex->unlock();
+		_psleep(1);
+		mWorkMutex->lock();
+	}
+	mWorkMutex->unlock();
+}
+
+void TheoraVideoManager::_resumeClip(TheoraVideoClip* clip)
+{
+	mWorkMutex->lock();
+	clip->mSuspended=0;
+	scheduleClip(clip);
+	mWorkMutex->unlock();
+	mWorkEvent->signal();
+}
+
 void TheoraVideoManager::update(float time_increase)
 {
+	mClock+=time_increase;
+	// callbacks run without the mutex, so they can create or destroy clips. clips are taken
+	// one at a time, a callback destroying another loaded clip removes it from mLoadedClips
+	TheoraVideoClip* clip;
+	for (;;)
+	{
+		mWorkMutex->lock();
+		clip=mLoadedClips.empty() ? NULL : mLoadedClips.front();
+		if (clip) mLoadedClips.erase(mLoadedClips.begin());
+		mWorkMutex->unlock();
+		if (!clip) break;
+		if (clip->isLoaded()) th_writelog(clip->getName()+": loaded");
+		if (clip->mLoadCallback) clip->mLoadCallback(clip,clip->isLoaded(),clip->mLoadCallbackData);
+	}
+
+	if (mFrameMemoryBudget > 0) distributeFrameMemory();
 	foreach(TheoraVideoClip*,mClips)
 	{
+		if (!(*it)->isLoaded()) continue;
 		(*it)->update(time_increase);
 		(*it)->decodedAudioCheck();
 	}
 }
 
+void TheoraVideoManager::setFrameMemoryBudget(size_t bytes)
+{
+	mFrameMemoryBudget=bytes;
+	if (bytes > 0) distributeFrameMemory();
+	else
+	{
+		mFramePool->setBudgetLimit((size_t) -1);
+		foreach(TheoraVideoClip*,mClips)
+			if ((*it)->isLoaded()) (*it)->_setFrameLimit(0);
+	}
+}
+
+void TheoraVideoManager::distributeFrameMemory()
+{
+	int i,n=mClips.size(),extra;
+	std::vector<int> limits(n),sizes(n);
+	std::vector<float> weights(n);
+	size_t used=0,share;
+	float sum=0;
+	TheoraVideoClip* clip;
+	for (i=0;i<n;i++)
+	{
+		clip=mClips[i];
+		if (!clip->isLoaded())
+		{
+			sizes[i]=limits[i]=0;
+			weights[i]=0;
+			continue;
+		}
+		sizes[i]=clip->_getFrameBufferSize();
+		limits[i]=std::min(clip->isVisible() ? 2 : 1,clip->getNumPrecachedFrames());
+		weights[i]=(clip->isVisible() && !clip->isPaused() && sizes[i] > 0) ? clip->getPriority() : 0;
+		used+=limits[i]*sizes[i];
+	}
+	// water filling: hand out the rest by weight, shares clips can't use go to the others
+	while (used < mFrameMemoryBudget)
+	{
+		sum=0;
+		for (i=0;i<n;i++)
+			if (weights[i] > 0 && limits[i] < mClips[i]->getNumPrecachedFrames()) sum+=weights[i];
+		if (sum == 0) break;
+		size_t left=mFrameMemoryBudget-used,prev=used;
+		for (i=0;i<n;i++)
+		{
+			if (weights[i] == 0 || limits[i] >= mClips[i]->getNumPrecachedFrames()) continue;
+			share=(size_t) (left*(weights[i]/sum));
+			extra=std::min((int) (share/sizes[i]),mClips[i]->getNumPrecachedFrames()-limits[i]);
+			limits[i]+=extra;
+			used+=extra*sizes[i];
+		}
+		if (used == prev) break;
+	}
+	for (i=0;i<n;i++)
+		if (mClips[i]->isLoaded()) mClips[i]->_setFrameLimit(limits[i]);
+	// idle pool buffers are frame memory too, they may only use what the frames leave over
+	mFramePool->setBudgetLimit((used < mFrameMemoryBudget) ? mFrameMemoryBudget-used : 0);
+}
+
 int TheoraVideoManager::getNumWorkerThreads()
 {
 	return mWorkerThreads.size();
@@ -190,6 +571,11 @@ void TheoraVideoManager::createWorkerThreads(int n)
 
 void TheoraVideoManager::destroyWorkerThreads()
 {
+	// stop all threads first, then wake up the idle ones so they can exit
+	foreach(TheoraWorkerThread*,mWorkerThreads)
+		(*it)->stopThread();
+	_signalWork();
+
 	foreach(TheoraWorkerThread*,mWorkerThreads)
 	{
 		(*it)->waitforThread();
@@ -13,6 +13,7 @@ the terms of the BSD license: http://www.opensource.org/licenses/bsd-license.php
 #include "TheoraVideoManager.h"
 #include "TheoraVideoClip.h"
 #include "TheoraUtil.h"
+#include "TheoraConversion.h"
 
 
 TheoraWorkerThread::TheoraWorkerThread() : TheoraThread()
@@ -27,13 +28,44 @@ TheoraWorkerThread::~TheoraWorkerThread()
 
 void TheoraWorkerThread::executeThread()
 {
-	mThreadRunning = true;
-	while (mThreadRunning)
+	TheoraVideoManager& mgr=TheoraVideoManager::getSingleton();
+	unsigned int events;
+	for (;;)
 	{
-		mClip=TheoraVideoManager::getSingleton().requestWork(this);
+		// read the event counter before looking for work, so a signal sent
+		// in between (or by destroyWorkerThreads) wakes us up immediately
+		events=mgr.mWorkEvent->getCount();
+		if (!mThreadRunning) break;
+
+		// help other threads convert large frames before taking on new work
+		TheoraConversionJob* job=mgr.requestConversionJob();
+		if (job)
+		{
+			job->run();
+			mgr.finishConversionJob(job);
+			continue;
+		}
+
+		mClip=mgr.requestWork(this);
 		if (!mClip)
 		{
-			_psleep(250);
+			// nothing to decode, load clips created with createVideoClipAsync()
+			TheoraVideoClip* clip=mgr.requestLoadWork(this);
+			if (clip)
+			{
+				clip->_loadAsync();
+				mgr.finishLoadWork(clip);
+				continue;
+			}
+			// or use the time to fill a clip's packet queue
+			clip=mgr.requestDemuxWork(this);
+			if (clip)
+			{
+				clip->_demuxAhead();
+				mgr.finishDemuxWork(clip);
+				continue;
+			}
+			mgr.mWorkEvent->wait(events);
 			continue;
 		}
 
@@ -43,8 +75,8 @@ void TheoraWorkerThread::executeThread()
 
 		mClip->decodeNextFrame();
 
-		mClip->mAssignedWorkerThread=NULL;
+		TheoraVideoClip* clip=mClip;
 		mClip=0;
-		_psleep(1);
+		mgr.finishWork(clip);
 	}
 }